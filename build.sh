@@ -10,4 +10,39 @@ else
     CFLAGS="-Wall -Wextra -Werror -fsanitize=undefined -O0 -ggdb -std=c++20 -Wno-overflow -Wno-format-security"
 fi
 
+# the optional modes below can follow the first argument in any order,
+# e.g. ./build.sh fast jit renderthread
+enabled(){
+    case " $OPTIONS " in
+        *" $1 "*) return 0 ;;
+    esac
+    return 1
+}
+[ $# -gt 0 ] && shift
+OPTIONS="$*"
+
+# direct-threaded (computed goto) CPU core instead of the step() loop
+if enabled threaded; then
+    echo building with threaded CPU core
+    CFLAGS="$CFLAGS -DVNES_THREADED_CORE"
+fi
+
+# translate hot PRG-ROM code to native x86-64 (x86-64 hosts only)
+if enabled jit; then
+    echo building with x86-64 JIT
+    CFLAGS="$CFLAGS -DVNES_JIT"
+fi
+
+# draw frames on a second thread from a log of the PPU's register writes
+if enabled renderthread; then
+    echo building with render thread
+    CFLAGS="$CFLAGS -DVNES_RENDER_THREAD"
+fi
+
+# plain C++ pixel kernels instead of the SSE2 and AVX2 ones
+if enabled nosimd; then
+    echo building without SIMD pixel kernels
+    CFLAGS="$CFLAGS -DVNES_NO_SIMD"
+fi
+
 g++ $CFLAGS -o vannes vannes.cpp $RAYLIB
@@ -7,18 +7,17 @@
 #include <fstream>
 #include <ios>
 #include <iostream>
-#include <memory>
 #include "cartridge.hpp"
 #include "../common/log.hpp"
 #include "../common/nes_assert.hpp"
 #include "../mappers/mapper_includes.hpp"
 
-Cartridge::Cartridge(std::string filename): mapper {nullptr} {
+Cartridge::Cartridge(std::string filename){
     load_rom(filename);
     set_mapper(); 
 }
 
-Cartridge::Cartridge(): mapper {nullptr}{ // dummy cart with 16k PRG and 8k CHR available
+Cartridge::Cartridge(){ // dummy cart with 16k PRG and 8k CHR available
     using namespace VNES_LOG;
 
     load_dummy_rom();
@@ -28,14 +27,14 @@ Cartridge::Cartridge(): mapper {nullptr}{ // dummy cart with 16k PRG and 8k CHR
 void Cartridge::set_mapper(){
     switch(mapper_number){
         case 0:
-            mapper = std::make_unique<Mapper000>(prg_rom, chr_rom);
+            mapper.emplace<Mapper000>(prg_rom, chr_rom);
             break;
         default:
-            mapper = std::make_unique<Mapper000>(prg_rom, chr_rom);
-            VNES_LOG::LOG(VNES_LOG::WARN, "Mapper number %d not recognized, setting default %s", mapper_number, mapper->name.c_str());
+            mapper.emplace<Mapper000>(prg_rom, chr_rom);
+            VNES_LOG::LOG(VNES_LOG::WARN, "Mapper number %d not recognized, setting default %s", mapper_number, std::get<Mapper000>(mapper).name.c_str());
             break;
     }
-    VNES_LOG::LOG(VNES_LOG::INFO, "Set cartridge mapper to %s", mapper->name.c_str());
+    VNES_LOG::LOG(VNES_LOG::INFO, "Set cartridge mapper to %s", std::visit([](auto& m){ return m.name.c_str(); }, mapper));
 }
 
 void Cartridge::load_dummy_rom(){
@@ -322,7 +321,7 @@ uint8_t Cartridge::read(uint16_t addr){
             return 0;
             break;
         case 0x4020 ... 0xFFFF:
-            return mapper->read(addr);
+            return std::visit([addr](auto& m){ return m.read(addr); }, mapper);
             break;
         default:
             LOG(ERROR, "Cartridge memory read at out-of-bounds address 0x%x (expected range is 0x4020 to 0xFFFF). Returning 0x0", addr);
@@ -331,22 +330,24 @@ uint8_t Cartridge::read(uint16_t addr){
     }
 }
 
-uint8_t Cartridge::read_pallete(uint16_t addr){
-    addr &= 0x3FFF;
-    if(addr > chr_rom.size() || !chr_rom.size()){
-        VNES_LOG::LOG(VNES_LOG::ERROR, "Out of bounds CHR ROM read at address 0x%x in CHR ROM of size 0x%x", addr, chr_rom.size());
-        addr %= chr_rom.size();
-    }
-    return chr_rom[addr];
+uint32_t Cartridge::prg_generation(){
+    return std::visit([](auto& m){ return m.prg_generation; }, mapper);
 }
 
-void Cartridge::write_pallete(uint16_t addr, uint8_t data){
-    addr &= 0x3FFF;
-    if(addr > chr_rom.size() || !chr_rom.size()){
-        VNES_LOG::LOG(VNES_LOG::ERROR, "Out of bounds CHR ROM write at address 0x%x with data 0x%x in CHR ROM of size 0x%x", addr, data, chr_rom.size());
-        addr %= chr_rom.size();
-    }
-    chr_rom[addr] = data;
+uint8_t* Cartridge::prg_page(uint8_t page, bool writable){
+    return std::visit([page, writable](auto& m){ return m.prg_page(page, writable); }, mapper);
+}
+
+uint8_t* Cartridge::chr_page(uint8_t page){
+    return std::visit([page](auto& m){ return m.chr_page(page); }, mapper);
+}
+
+uint8_t* Cartridge::nametable_page(uint8_t table, uint8_t* ciram){
+    return std::visit([this, table, ciram](auto& m){ return m.nametable_page(table, ciram, nametable_layout); }, mapper);
+}
+
+uint32_t Cartridge::chr_generation(){
+    return std::visit([](auto& m){ return m.chr_generation; }, mapper);
 }
 
 void Cartridge::write(uint16_t addr, uint8_t data){
@@ -356,11 +357,11 @@ void Cartridge::write(uint16_t addr, uint8_t data){
             LOG(ERROR, "Cartridge memory write at out-of-bounds address 0x%x (expected range is 0x4020 to 0x8000). Write has no effect", addr);
             break;
         case 0x4020 ... 0x7FFF:
-            mapper->write(addr, data);
+            std::visit([addr, data](auto& m){ m.write(addr, data); }, mapper);
             break;
         case 0x8000 ... 0xFFFF:
             LOG(WARN, "Cartridge memory write to read-only address 0x%x (expected range is 0x4020 to 0x8000). Write will be allowed but should be noted", addr);
-            mapper->write(addr, data);
+            std::visit([addr, data](auto& m){ m.write(addr, data); }, mapper);
             break;
         default:
             LOG(ERROR, "Cartridge memory write at out-of-bounds address 0x%x (expected range is 0x4020 to 0x8000). Write has no effect", addr);
@@ -4,8 +4,7 @@
 #include <vector>
 #include <optional>
 #include <array>
-#include "../mappers/Mapper.hpp"
-#include <memory>
+#include "../mappers/mapper_includes.hpp"
 #include "header.cpp"
 
 /*
@@ -22,9 +21,12 @@ class Cartridge{
 
         uint8_t read(uint16_t addr); // reads from mapper
         void    write(uint16_t addr, uint8_t data); // write to cart RAM, sometimes battery backed 
+        uint32_t prg_generation(); // changes whenever the mapper remaps or modifies PRG-ROM
+        uint8_t* prg_page(uint8_t page, bool writable); // see Mapper::prg_page()
 
-        uint8_t read_pallete(uint16_t addr);
-        void write_pallete(uint16_t addr, uint8_t data);
+        uint8_t* chr_page(uint8_t page); // see Mapper::chr_page()
+        uint8_t* nametable_page(uint8_t table, uint8_t* ciram); // see Mapper::nametable_page()
+        uint32_t chr_generation(); // changes whenever the mapper remaps CHR or nametables
 
         typedef enum NametableLayout{
             VERTICAL = 0, // vertical arrangement = "horizontally mirrored"
@@ -34,7 +36,7 @@ class Cartridge{
         NametableLayout nametable_layout;
 
     private:
-        std::unique_ptr<Mapper> mapper; 
+        MapperVariant mapper; // see mapper_includes.hpp
         void set_mapper();
 
         // see  for explanations of flags
@@ -1,3 +1,603 @@
 #pragma once
 
 #include "include/APU.hpp"
+#include "../common/log.hpp"
+#include <algorithm>
+#include <string.h>
+
+APU::APU(RAM& _ram, Scheduler& _scheduler): ram {_ram}, scheduler {_scheduler} {
+    VNES_LOG::LOG(VNES_LOG::INFO, "Constructing APU");
+    // see https://www.nesdev.org/wiki/APU_Mixer
+    pulse_table[0] = 0;
+    for(int i = 1; i < 31; i++){
+        pulse_table[i] = 95.52f / (8128.0f / i + 100);
+    }
+    tnd_table[0] = 0;
+    for(int i = 1; i < 203; i++){
+        tnd_table[i] = 163.67f / (24329.0f / i + 100);
+    }
+    power_up();
+}
+
+const uint8_t APU::LENGTH_TABLE[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+// read backwards, the sequencer counts down
+const uint8_t APU::DUTY_TABLE[4][8] = {
+    {0, 1, 0, 0, 0, 0, 0, 0}, // 12.5%
+    {0, 1, 1, 0, 0, 0, 0, 0}, // 25%
+    {0, 1, 1, 1, 1, 0, 0, 0}, // 50%
+    {1, 0, 0, 1, 1, 1, 1, 1}  // 25% negated
+};
+
+const uint8_t APU::TRIANGLE_SEQUENCE[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+// NTSC, in CPU cycles
+const uint16_t APU::NOISE_PERIODS[16] = {4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068};
+const uint16_t APU::DMC_PERIODS[16] = {428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54};
+
+void APU::power_up(){
+    memset(pulse, 0, sizeof(pulse));
+    memset(&triangle, 0, sizeof(triangle));
+    memset(&noise, 0, sizeof(noise));
+    memset(&dmc, 0, sizeof(dmc));
+
+    pulse[0].ones_complement = true;
+    for(Pulse& p : pulse){
+        p.counter = 2;
+    }
+    triangle.counter = 1;
+    noise.period = NOISE_PERIODS[0];
+    noise.counter = noise.period;
+    noise.shift_register = 1;
+    dmc.period = DMC_PERIODS[0];
+    dmc.counter = dmc.period;
+    dmc.bits_remaining = 8;
+    dmc.silence = true;
+
+    // as if $4017 was written with 0
+    five_step_mode = false;
+    frame_irq_inhibit = false;
+    frame_irq = false;
+    dmc_irq = false;
+    frame_step_cycle = 0;
+
+    timestamp = 0;
+    frame_time = 0;
+    mixed_output = 0;
+    blip.clear();
+    update_irq();
+    schedule_irq();
+}
+
+// the channels are silenced, the frame counter keeps its mode
+void APU::reset(){
+    register_write(SND_CHN, 0x00);
+    frame_irq = false;
+    update_irq();
+    schedule_irq();
+}
+
+void APU::register_write(uint16_t addr, uint8_t data){
+    switch(addr){
+        case SQ1_VOL:
+        case SQ2_VOL:{
+            Pulse& p = pulse[(addr >> 2) & 1];
+            p.duty = data >> 6;
+            p.envelope.loop = data & 0x20;
+            p.envelope.constant = data & 0x10;
+            p.envelope.volume = data & 0x0F;
+            break;
+        }
+        case SQ1_SWEEP:
+        case SQ2_SWEEP:{
+            Pulse& p = pulse[(addr >> 2) & 1];
+            p.sweep_enabled = data & 0x80;
+            p.sweep_period = (data >> 4) & 0x07;
+            p.sweep_negate = data & 0x08;
+            p.sweep_shift = data & 0x07;
+            p.sweep_reload = true;
+            break;
+        }
+        case SQ1_LO:
+        case SQ2_LO:{
+            Pulse& p = pulse[(addr >> 2) & 1];
+            p.period = (p.period & 0x0700) | data;
+            break;
+        }
+        case SQ1_HI:
+        case SQ2_HI:{
+            Pulse& p = pulse[(addr >> 2) & 1];
+            p.period = (p.period & 0x00FF) | ((data & 0x07) << 8);
+            if(p.enabled){
+                p.length = LENGTH_TABLE[data >> 3];
+            }
+            p.sequence_step = 0;
+            p.envelope.start = true;
+            break;
+        }
+
+        case TRI_LINEAR:
+            triangle.control = data & 0x80;
+            triangle.linear_reload_value = data & 0x7F;
+            break;
+        case TRI_LO:
+            triangle.period = (triangle.period & 0x0700) | data;
+            break;
+        case TRI_HI:
+            triangle.period = (triangle.period & 0x00FF) | ((data & 0x07) << 8);
+            if(triangle.enabled){
+                triangle.length = LENGTH_TABLE[data >> 3];
+            }
+            triangle.linear_reload = true;
+            break;
+
+        case NOISE_VOL:
+            noise.envelope.loop = data & 0x20;
+            noise.envelope.constant = data & 0x10;
+            noise.envelope.volume = data & 0x0F;
+            break;
+        case NOISE_CTRL:
+            noise.short_mode = data & 0x80;
+            noise.period = NOISE_PERIODS[data & 0x0F];
+            break;
+        case NOISE_LEN:
+            if(noise.enabled){
+                noise.length = LENGTH_TABLE[data >> 3];
+            }
+            noise.envelope.start = true;
+            break;
+
+        case DMC_FREQ:
+            dmc.irq_enabled = data & 0x80;
+            dmc.loop = data & 0x40;
+            dmc.period = DMC_PERIODS[data & 0x0F];
+            if(!dmc.irq_enabled){
+                dmc_irq = false;
+            }
+            break;
+        case DMC_RAW:
+            dmc.level = data & 0x7F;
+            break;
+        case DMC_START:
+            dmc.sample_address = 0xC000 | (data << 6);
+            break;
+        case DMC_LEN:
+            dmc.sample_length = (data << 4) + 1;
+            break;
+
+        case SND_CHN:
+            pulse[0].enabled = data & 0x01;
+            pulse[1].enabled = data & 0x02;
+            triangle.enabled = data & 0x04;
+            noise.enabled = data & 0x08;
+            for(Pulse& p : pulse){
+                if(!p.enabled){
+                    p.length = 0;
+                }
+            }
+            if(!triangle.enabled){
+                triangle.length = 0;
+            }
+            if(!noise.enabled){
+                noise.length = 0;
+            }
+            if(!(data & 0x10)){
+                dmc.bytes_remaining = 0;
+            }else if(dmc.bytes_remaining == 0){
+                restart_dmc_sample();
+                fetch_dmc_sample();
+            }
+            dmc_irq = false;
+            break;
+
+        case JOY2: // frame counter
+            five_step_mode = data & 0x80;
+            frame_irq_inhibit = data & 0x40;
+            if(frame_irq_inhibit){
+                frame_irq = false;
+            }
+            // the sequence restarts 3 or 4 cycles later, depending on
+            // whether the write lands between APU cycles
+            frame_step_cycle = ((timestamp / Scheduler::CPU_CLOCK_DIVIDER) & 1) ? -4 : -3;
+            if(five_step_mode){
+                clock_quarter_frame();
+                clock_half_frame();
+            }
+            break;
+
+        default: // 0x4009 and 0x400D are unused
+            break;
+    }
+    update_output();
+    update_irq();
+    schedule_irq();
+}
+
+uint8_t APU::register_read(uint16_t addr){
+    if(addr != SND_CHN){
+        VNES_LOG::LOG(VNES_LOG::WARN, "Read from write-only APU address 0x%x", addr);
+        return 0;
+    }
+    const uint8_t data = (pulse[0].length ? 0x01 : 0)
+                       | (pulse[1].length ? 0x02 : 0)
+                       | (triangle.length ? 0x04 : 0)
+                       | (noise.length ? 0x08 : 0)
+                       | (dmc.bytes_remaining ? 0x10 : 0)
+                       | (frame_irq ? 0x40 : 0)
+                       | (dmc_irq ? 0x80 : 0);
+    frame_irq = false; // reading acknowledges the frame IRQ, but not the DMC's
+    update_irq();
+    schedule_irq();
+    return data;
+}
+
+// Between register accesses the APU runs on its own, so it only has to be
+// stepped a cycle at a time on the cycles where something can be heard or
+// seen to change: the frame counter's steps, and the timers of channels
+// that are making a sound. Everything in between is skipped in one go.
+void APU::run_until(uint64_t target_timestamp){
+    while(timestamp < target_timestamp){
+        const uint32_t cycles_left = (target_timestamp - timestamp + Scheduler::CPU_CLOCK_DIVIDER - 1) / Scheduler::CPU_CLOCK_DIVIDER;
+        const uint32_t cycles = cycles_until_change();
+        if(cycles > cycles_left){
+            skip(cycles_left);
+            break;
+        }
+        skip(cycles - 1);
+        clock();
+        timestamp += Scheduler::CPU_CLOCK_DIVIDER;
+    }
+    schedule_irq();
+}
+
+// Cycles until the next cycle that may change the output, or anything the
+// CPU can see, counting that cycle
+uint32_t APU::cycles_until_change() const {
+    uint32_t cycles = cycles_until_frame_step();
+    for(const Pulse& p : pulse){
+        if(p.length && !p.muted() && p.envelope.output()){
+            cycles = std::min(cycles, p.counter);
+        }
+    }
+    if(triangle.steps()){
+        cycles = std::min(cycles, triangle.counter);
+    }
+    if(noise.length && noise.envelope.output()){
+        cycles = std::min(cycles, noise.counter);
+    }
+    if(!dmc.silence || dmc.buffer_full){
+        cycles = std::min(cycles, dmc.counter);
+    }
+    return cycles;
+}
+
+// Runs cycles that cycles_until_change() says change nothing. The timers
+// still run, but their channels are silent, so only where they end up
+// matters.
+void APU::skip(uint32_t cycles){
+    if(cycles == 0){
+        return;
+    }
+    timestamp += (uint64_t)cycles * Scheduler::CPU_CLOCK_DIVIDER;
+    frame_time += cycles;
+
+    frame_step_cycle += cycles;
+    if(frame_step_cycle >= sequence_length()){
+        frame_step_cycle -= sequence_length();
+    }
+
+    for(Pulse& p : pulse){
+        const uint32_t ticks = advance_timer(p.counter, 2 * (p.period + 1), cycles);
+        p.sequence_step = (p.sequence_step - ticks) & 0x07;
+    }
+
+    advance_timer(triangle.counter, triangle.period + 1, cycles); // the triangle holds still
+
+    // the shift register has no shortcut, but it's only a few operations a step
+    for(uint32_t ticks = advance_timer(noise.counter, noise.period, cycles); ticks; ticks--){
+        clock_noise_shift_register();
+    }
+
+    // silent and with nothing to play, so only the bit count moves
+    const uint32_t dmc_ticks = advance_timer(dmc.counter, dmc.period, cycles);
+    dmc.bits_remaining = (dmc.bits_remaining + 7 - dmc_ticks % 8) % 8 + 1;
+    dmc.shift_register = (dmc_ticks >= 8) ? 0 : dmc.shift_register >> dmc_ticks;
+}
+
+// Counts a timer down by cycles, returns how many times it clocked
+uint32_t APU::advance_timer(uint32_t& counter, uint32_t period, uint32_t cycles){
+    if(cycles < counter){
+        counter -= cycles;
+        return 0;
+    }
+    const uint32_t after_first = cycles - counter;
+    counter = period - after_first % period;
+    return 1 + after_first / period;
+}
+
+void APU::end_frame(){
+    blip.end_frame(frame_time);
+    frame_time = 0;
+}
+
+// one CPU cycle
+void APU::clock(){
+    clock_frame_counter();
+
+    for(Pulse& p : pulse){
+        if(--p.counter == 0){
+            p.counter = 2 * (p.period + 1);
+            p.sequence_step = (p.sequence_step - 1) & 0x07;
+        }
+    }
+
+    if(--triangle.counter == 0){
+        triangle.counter = triangle.period + 1;
+        if(triangle.steps()){
+            triangle.sequence_step = (triangle.sequence_step + 1) & 0x1F;
+        }
+    }
+
+    if(--noise.counter == 0){
+        noise.counter = noise.period;
+        clock_noise_shift_register();
+    }
+
+    clock_dmc();
+    update_output();
+    frame_time++;
+}
+
+// see https://www.nesdev.org/wiki/APU_Frame_Counter
+void APU::clock_frame_counter(){
+    frame_step_cycle++;
+    if(frame_step_cycle == sequence_length()){
+        frame_step_cycle = 0;
+    }
+
+    if(frame_step_cycle == QUARTER_FRAME_CYCLES[0] || frame_step_cycle == QUARTER_FRAME_CYCLES[2]){
+        clock_quarter_frame();
+    }else if(frame_step_cycle == QUARTER_FRAME_CYCLES[1]){
+        clock_quarter_frame();
+        clock_half_frame();
+    }else if(frame_step_cycle == QUARTER_FRAME_CYCLES[3] && !five_step_mode){
+        clock_quarter_frame();
+        clock_half_frame();
+        if(!frame_irq_inhibit){
+            frame_irq = true;
+            update_irq();
+        }
+    }else if(frame_step_cycle == FIVE_STEP_LAST_CYCLE){
+        clock_quarter_frame();
+        clock_half_frame();
+    }
+}
+
+// envelopes and the triangle's linear counter
+void APU::clock_quarter_frame(){
+    pulse[0].envelope.clock();
+    pulse[1].envelope.clock();
+    noise.envelope.clock();
+
+    if(triangle.linear_reload){
+        triangle.linear_counter = triangle.linear_reload_value;
+    }else if(triangle.linear_counter){
+        triangle.linear_counter--;
+    }
+    if(!triangle.control){
+        triangle.linear_reload = false;
+    }
+}
+
+// length counters and sweeps
+void APU::clock_half_frame(){
+    for(Pulse& p : pulse){
+        if(p.length && !p.envelope.loop){
+            p.length--;
+        }
+        p.clock_sweep();
+    }
+    if(triangle.length && !triangle.control){
+        triangle.length--;
+    }
+    if(noise.length && !noise.envelope.loop){
+        noise.length--;
+    }
+}
+
+void APU::Envelope::clock(){
+    if(start){
+        start = false;
+        decay = 15;
+        divider = volume;
+    }else if(divider == 0){
+        divider = volume;
+        if(decay){
+            decay--;
+        }else if(loop){
+            decay = 15;
+        }
+    }else{
+        divider--;
+    }
+}
+
+uint16_t APU::Pulse::sweep_target() const {
+    const int change = period >> sweep_shift;
+    if(!sweep_negate){
+        return period + change;
+    }
+    return std::max(period - change - (ones_complement ? 1 : 0), 0);
+}
+
+void APU::Pulse::clock_sweep(){
+    if(sweep_divider == 0 && sweep_enabled && sweep_shift && !muted()){
+        period = sweep_target();
+    }
+    if(sweep_divider == 0 || sweep_reload){
+        sweep_divider = sweep_period;
+        sweep_reload = false;
+    }else{
+        sweep_divider--;
+    }
+}
+
+uint8_t APU::Pulse::output() const {
+    if(!length || muted() || !DUTY_TABLE[duty][sequence_step]){
+        return 0;
+    }
+    return envelope.output();
+}
+
+void APU::clock_noise_shift_register(){
+    const uint16_t feedback = (noise.shift_register ^ (noise.shift_register >> (noise.short_mode ? 6 : 1))) & 0x01;
+    noise.shift_register = (noise.shift_register >> 1) | (feedback << 14);
+}
+
+uint8_t APU::Triangle::output() const {
+    return TRIANGLE_SEQUENCE[sequence_step];
+}
+
+/* DMC */
+/* The output unit plays the sample byte in its shift register a bit at a
+ * time, moving the level up or down by 2. When a byte runs out it takes the
+ * next one from the sample buffer, which is filled from memory as soon as
+ * it empties while there are bytes of the sample left. So the buffer is
+ * always full while bytes are left, and those are fetched a byte's worth of
+ * bits apart.
+ */
+void APU::clock_dmc(){
+    if(--dmc.counter != 0){
+        return;
+    }
+    dmc.counter = dmc.period;
+
+    if(!dmc.silence){
+        if(dmc.shift_register & 0x01){
+            if(dmc.level <= 125){
+                dmc.level += 2;
+            }
+        }else if(dmc.level >= 2){
+            dmc.level -= 2;
+        }
+    }
+    dmc.shift_register >>= 1;
+
+    if(--dmc.bits_remaining == 0){
+        dmc.bits_remaining = 8;
+        dmc.silence = !dmc.buffer_full;
+        if(dmc.buffer_full){
+            dmc.shift_register = dmc.buffer;
+            dmc.buffer_full = false;
+            fetch_dmc_sample();
+        }
+    }
+}
+
+// The CPU is halted for the fetch on the real thing, that isn't emulated
+void APU::fetch_dmc_sample(){
+    if(dmc.buffer_full || dmc.bytes_remaining == 0){
+        return;
+    }
+    dmc.buffer = ram.read(dmc.address);
+    dmc.buffer_full = true;
+    dmc.address = (dmc.address == 0xFFFF) ? 0x8000 : dmc.address + 1;
+    dmc.bytes_remaining--;
+    if(dmc.bytes_remaining == 0){
+        if(dmc.loop){
+            restart_dmc_sample();
+        }else if(dmc.irq_enabled){
+            dmc_irq = true;
+            update_irq();
+        }
+    }
+}
+
+void APU::restart_dmc_sample(){
+    dmc.address = dmc.sample_address;
+    dmc.bytes_remaining = dmc.sample_length;
+}
+
+/* output */
+// Adds a step to the audio wherever the mixed output changed
+void APU::update_output(){
+    const float output = pulse_table[pulse[0].output() + pulse[1].output()]
+                       + tnd_table[3 * triangle.output() + 2 * noise.output() + dmc.level];
+    if(output != mixed_output){
+        blip.add_delta(frame_time, output - mixed_output);
+        mixed_output = output;
+    }
+}
+
+/* IRQs */
+void APU::update_irq(){
+    if(frame_irq){
+        scheduler.assert_irq(Scheduler::IRQ_APU_FRAME);
+    }else{
+        scheduler.release_irq(Scheduler::IRQ_APU_FRAME);
+    }
+    if(dmc_irq){
+        scheduler.assert_irq(Scheduler::IRQ_DMC);
+    }else{
+        scheduler.release_irq(Scheduler::IRQ_DMC);
+    }
+}
+
+// The CPU has to see the IRQ line go up when it happens, so the APU is
+// caught up then, on the timestamp right after the cycle that raises it
+void APU::schedule_irq(){
+    int cycles = cycles_until_frame_irq();
+    const int dmc_cycles = cycles_until_dmc_irq();
+    if(cycles < 0 || (dmc_cycles >= 0 && dmc_cycles < cycles)){
+        cycles = dmc_cycles;
+    }
+    if(cycles < 0){
+        scheduler.cancel(Scheduler::APU_IRQ);
+    }else{
+        scheduler.schedule(Scheduler::APU_IRQ, timestamp + (uint64_t)cycles * Scheduler::CPU_CLOCK_DIVIDER);
+    }
+}
+
+// cycles until the frame counter raises its IRQ, counting the cycle that
+// does it, or -1 if it won't (or it's already up, which only a register
+// access can change)
+int APU::cycles_until_frame_irq() const {
+    if(five_step_mode || frame_irq_inhibit || frame_irq){
+        return -1;
+    }
+    return cycles_until_frame_cycle(QUARTER_FRAME_CYCLES[3]);
+}
+
+// cycles until frame_step_cycle comes round to the given cycle, counting
+// the cycle it does
+int APU::cycles_until_frame_cycle(int cycle) const {
+    if(frame_step_cycle < 0){
+        return cycle - frame_step_cycle; // the sequence restarts before it gets there
+    }
+    const int length = sequence_length();
+    const int cycles = ((cycle - frame_step_cycle) % length + length) % length;
+    return cycles ? cycles : length;
+}
+
+uint32_t APU::cycles_until_frame_step() const {
+    int cycles = cycles_until_frame_cycle(five_step_mode ? FIVE_STEP_LAST_CYCLE : QUARTER_FRAME_CYCLES[3]);
+    for(int i = 0; i < 3; i++){
+        cycles = std::min(cycles, cycles_until_frame_cycle(QUARTER_FRAME_CYCLES[i]));
+    }
+    return cycles;
+}
+
+// cycles until the DMC fetches the last byte of its sample and raises its
+// IRQ, see clock_dmc()
+int APU::cycles_until_dmc_irq() const {
+    if(!dmc.irq_enabled || dmc.loop || dmc.bytes_remaining == 0 || dmc_irq){
+        return -1;
+    }
+    return dmc.counter + (dmc.bits_remaining - 1) * dmc.period + (dmc.bytes_remaining - 1) * 8 * dmc.period;
+}
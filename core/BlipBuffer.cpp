@@ -0,0 +1,85 @@
+#pragma once
+
+#include "include/BlipBuffer.hpp"
+#include <algorithm>
+#include <math.h>
+
+BlipBuffer::BlipBuffer(double clock_rate, int _sample_rate): sample_rate {_sample_rate} {
+    samples_per_clock = (uint64_t)llround(sample_rate / clock_rate * (double)(1ull << FRAC_BITS));
+
+    // Each phase is a sinc cut off a little below Nyquist under a Blackman
+    // window, delayed by half the kernel so it fits after the step. The
+    // taps of each phase add up to 1, so summing the deltas back up gives
+    // exactly the step.
+    const double cutoff = 0.45; // cycles per sample
+    const double delay = KERNEL_WIDTH / 2 - 1;
+    for(int phase = 0; phase < PHASES; phase++){
+        double taps[KERNEL_WIDTH];
+        double sum = 0;
+        for(int i = 0; i < KERNEL_WIDTH; i++){
+            const double x = i - delay - (double)phase / PHASES; // samples from the step
+            const double sinc = (x == 0) ? 1 : sin(2 * M_PI * cutoff * x) / (2 * M_PI * cutoff * x);
+            const double angle = M_PI * x / (KERNEL_WIDTH / 2);
+            const double window = 0.42 + 0.5 * cos(angle) + 0.08 * cos(2 * angle);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+        for(int i = 0; i < KERNEL_WIDTH; i++){
+            kernel[phase][i] = (float)(taps[i] / sum);
+        }
+    }
+
+    const double rc = 1 / (2 * M_PI * 90); // 90 Hz
+    highpass_factor = (float)(rc / (rc + 1.0 / sample_rate));
+
+    deltas.assign(sample_rate / 10 + KERNEL_WIDTH, 0);
+    clear();
+}
+
+void BlipBuffer::clear(){
+    std::fill(deltas.begin(), deltas.end(), 0);
+    frame_start = 0;
+    available = 0;
+    level = 0;
+    highpass_in = 0;
+    highpass_out = 0;
+}
+
+void BlipBuffer::add_delta(uint32_t time, float delta){
+    const uint64_t position = frame_start + time * samples_per_clock;
+    const size_t index = position >> FRAC_BITS;
+    const int phase = (position >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1);
+    if(index + KERNEL_WIDTH > deltas.size()){
+        deltas.resize(index + KERNEL_WIDTH, 0); // nobody has been reading samples
+    }
+    float* out = &deltas[index];
+    for(int i = 0; i < KERNEL_WIDTH; i++){
+        out[i] += delta * kernel[phase][i];
+    }
+}
+
+// Samples before the start of the next frame are final, since every step
+// from then on is spread over the samples after it
+void BlipBuffer::end_frame(uint32_t time){
+    frame_start += time * samples_per_clock;
+    available = frame_start >> FRAC_BITS;
+    if((size_t)available + KERNEL_WIDTH > deltas.size()){
+        deltas.resize(available + KERNEL_WIDTH, 0);
+    }
+}
+
+int BlipBuffer::read_samples(int16_t* out, int count){
+    count = std::min(count, available);
+    for(int i = 0; i < count; i++){
+        level += deltas[i];
+        highpass_out = highpass_factor * (highpass_out + level - highpass_in);
+        highpass_in = level;
+        out[i] = (int16_t)std::clamp(lrintf(highpass_out * 32767), -32768l, 32767l);
+    }
+
+    std::copy(deltas.begin() + count, deltas.end(), deltas.begin());
+    std::fill(deltas.end() - count, deltas.end(), 0);
+    frame_start -= (uint64_t)count << FRAC_BITS;
+    available -= count;
+    return count;
+}
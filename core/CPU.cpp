@@ -1,14 +1,20 @@
 #pragma once
 
 #include <iostream>
-#include <sstream>
 #include <algorithm>
 #include "include/CPU.hpp"
 #include "../common/nes_assert.hpp"
 #include "../common/log.hpp"
 
-CPU::CPU(RAM& _ram, PPU& _ppu): ram {_ram}, ppu {_ppu}{
+CPU::CPU(RAM& _ram, PPU& _ppu, Scheduler& _scheduler): ram {_ram}, ppu {_ppu}, scheduler {_scheduler}{
     VNES_LOG::LOG(VNES_LOG::INFO, "Constructing CPU...");
+    decode_cache.assign(0x8000, DecodedInstruction{}); // generation 0 is never valid
+    decode_generation = 1;
+    seen_prg_generation = ram.prg_generation();
+    slice_deadline = 0;
+    map_pages();
+    idle_loop.generation = 0;
+    idle_loop.probed = false;
     power_up();
     //printf("after powerup, PC is (decimal) %u\n", program_counter);
 }
@@ -18,25 +24,17 @@ void CPU::step(){
 
     //printf("cpu step\n");
 
-    //if(ppu.check_nmi()){ // start of vblank
-    //    raise_interrupt(false);
-    //}
+    poll_interrupts();
 
-    uint8_t opcode = fetch_instruction();
-    LOG(DEBUG, "Fetched opcode 0x%x from address 0x%x", opcode, program_counter);
+    const DecodedInstruction& decoded = fetch_instruction();
+    uint8_t opcode = decoded.opcode;
     uint64_t cycles_before = frame_cycles;
-    execute_instruction(opcode);
-    int cycles_done = frame_cycles - cycles_before; 
-    cycles_since_reset += cycles_done;
-    LOG(DEBUG, "Opcode consumed %d cycles (%lld this frame)", cycles_done, frame_cycles);
-    program_counter++;
+    execute_instruction(decoded);
+    retire_instruction(opcode, frame_cycles - cycles_before);
 
-    ppu.do_cycles(cycles_done*3);
-    std::stringstream ss {};
-    ss << (OPCODE)opcode;
-    VNES_LOG::LOG(VNES_LOG::DEBUG, "Executing instruction %s", ss.str().c_str());
-    //LOG(INFO, "%x  %s  A:%x X:%x Y:%x P:%x SP:%x\n", program_counter, ss.str().c_str(), accumulator, index_X, index_Y, status_as_int(), stack_pointer);
-    printf("%x  %s  A:%2x X:%2x Y:%2x P:%2x SP:%2x\n", program_counter, ss.str().c_str(), accumulator, index_X, index_Y, status_as_int(), stack_pointer);
+    if(timestamp() >= scheduler.next_event_time()){
+        service_events();
+    }
 
     //uint32_t addr = 0x0180;
     //while(addr <= 0x2000){
@@ -46,24 +44,366 @@ void CPU::step(){
     //}
 }
 
-inline uint8_t CPU::fetch_instruction(){
-    return read_mem(program_counter);
+// bookkeeping after every instruction run through step()
+inline void CPU::retire_instruction(uint8_t opcode, int cycles_done){
+    cycles_since_reset += cycles_done;
+    program_counter++;
+    trace_instruction(opcode);
+}
+
+inline void CPU::trace_instruction(uint8_t opcode){
+    VNES_LOG::LOG(VNES_LOG::DEBUG, "%x  %s  A:%2x X:%2x Y:%2x P:%2x SP:%2x", program_counter, instruction_table[opcode].name, accumulator, index_X, index_Y, status_as_int(), stack_pointer);
+}
+
+// Runs instructions until frame_cycles reaches the deadline. Unlike calling
+// step() in a loop, the per-batch state (deadline, trace setting, cycle
+// count at the start of the batch) is kept in locals and cycles_since_reset
+// is only written back once the batch is done. The batch is run in slices
+// that end where the next scheduled event is due, so the instruction loops
+// only ever compare against one deadline, and interrupts are taken between
+// slices.
+// Returns the number of instructions executed.
+uint64_t CPU::run_until(uint64_t cycle_deadline){
+    const bool trace = tracing();
+    const uint64_t batch_start_cycles = frame_cycles;
+    uint64_t instructions_done = 0;
+
+    while(frame_cycles < cycle_deadline){
+        poll_interrupts();
+        slice_deadline = std::min(cycle_deadline, next_event_cycle());
+        idle_loop.probed = false; // an event may change what an idle loop reads
+
+#if defined(VNES_JIT)
+        instructions_done += run_jit(trace);
+#elif defined(VNES_THREADED_CORE)
+        instructions_done += run_threaded(trace);
+#else
+        instructions_done += run_interpreter(trace);
+#endif
+
+        if(timestamp() >= scheduler.next_event_time()){
+            service_events();
+        }
+    }
+
+    cycles_since_reset += frame_cycles - batch_start_cycles;
+    return instructions_done;
+}
+
+// The plain instruction loop used by run_until()
+// Returns the number of instructions executed.
+uint64_t CPU::run_interpreter(bool trace){
+    uint64_t instructions_done = 0;
+
+    while(frame_cycles < slice_deadline){
+        uint16_t opcode_pc = program_counter;
+        const DecodedInstruction& decoded = fetch_instruction();
+        uint8_t opcode = decoded.opcode;
+        execute_instruction(decoded);
+        program_counter++;
+
+        if(trace){ trace_instruction(opcode); }
+        instructions_done++;
+
+        if(!trace && program_counter <= opcode_pc && instruction_table[opcode].mode == REL){
+            skip_idle_loop(instructions_done);
+        }
+    }
+    return instructions_done;
+}
+
+// frame_cycles at which the next scheduled event is due
+inline uint64_t CPU::next_event_cycle(){
+    uint64_t next_event = scheduler.next_event_time();
+    if(next_event == Scheduler::NEVER){
+        return UINT64_MAX;
+    }
+    uint64_t next_cycle = (next_event + Scheduler::CPU_CLOCK_DIVIDER - 1) / Scheduler::CPU_CLOCK_DIVIDER; // first CPU cycle at or after the event
+    return std::max(next_cycle, frame_start_cycle + frame_cycles) - frame_start_cycle;
+}
+
+// Takes a latched NMI, or an IRQ if the line is asserted and interrupts
+// aren't disabled. Interrupts are only taken between instructions, and
+// run_until() only calls this between slices, so anything that can make an
+// interrupt pending in the middle of a slice has to end it with end_slice().
+inline void CPU::poll_interrupts(){
+    if(scheduler.take_nmi()){
+        raise_interrupt(false, false);
+    }else if(scheduler.irq_asserted() && !interrupt_disable_f){
+        raise_interrupt(true, false);
+    }
+}
+
+// Makes the run loops return after the current instruction
+inline void CPU::end_slice(){
+    slice_deadline = frame_cycles;
+}
+
+// Catches up every component whose event is due
+void CPU::service_events(){
+    uint64_t now = timestamp();
+    if(scheduler.due(Scheduler::PPU_VBLANK, now) || scheduler.due(Scheduler::PPU_STATUS, now)){
+        ppu.run_until(now);
+    }
+    if(scheduler.due(Scheduler::APU_IRQ, now)){
+        apu.run_until(now);
+    }
+}
+
+#if defined(VNES_JIT)
+// Same as the run_until() loop, but hot blocks of PRG-ROM code are run as
+// native code when they finish before the deadline. Tracing needs every
+// instruction, so it disables translated code.
+uint64_t CPU::run_jit(bool trace){
+    uint64_t instructions_done = 0;
+
+    while(frame_cycles < slice_deadline){
+        if(!trace){
+            JIT::Block* block = jit.lookup(program_counter);
+            // every instruction in the block must start before the deadline, 
+            // like they would in the interpreter
+            if(block && frame_cycles + block->cycles_before_exit < slice_deadline){
+                uint16_t block_pc = program_counter;
+                instructions_done += run_block(*block);
+                if(program_counter <= block_pc){
+                    skip_idle_loop(instructions_done);
+                }
+                continue;
+            }
+        }
+
+        uint16_t opcode_pc = program_counter;
+        const DecodedInstruction& decoded = fetch_instruction();
+        uint8_t opcode = decoded.opcode;
+        execute_instruction(decoded);
+        program_counter++;
+
+        if(trace){ trace_instruction(opcode); }
+        instructions_done++;
+
+        if(!trace && program_counter <= opcode_pc && instruction_table[opcode].mode == REL){
+            skip_idle_loop(instructions_done);
+        }
+    }
+    return instructions_done;
+}
+
+// translated code has no side effects outside of registers and internal RAM
+uint64_t CPU::run_block(JIT::Block& block){
+    JIT::State& state = jit.state;
+    state.accumulator           = accumulator;
+    state.index_X               = index_X;
+    state.index_Y               = index_Y;
+    state.carry_f               = carry_f;
+    state.overflow_f            = overflow_f;
+    state.decimal_f             = decimal_f;
+    state.interrupt_disable_f   = interrupt_disable_f;
+    state.nz_result             = nz_result;
+
+    block.code(&state);
+
+    accumulator         = state.accumulator;
+    index_X             = state.index_X;
+    index_Y             = state.index_Y;
+    carry_f             = state.carry_f;
+    overflow_f          = state.overflow_f;
+    decimal_f           = state.decimal_f;
+    interrupt_disable_f = state.interrupt_disable_f;
+    nz_result           = state.nz_result;
+    program_counter     = state.program_counter;
+
+    frame_cycles += state.cycles;
+    return block.instructions;
+}
+#endif
+
+// Runs one frame worth of CPU cycles. The last instruction may overshoot the
+// end of the frame, so the extra cycles are carried into the next frame.
+// The PPU is caught up at the end so the frame can be drawn.
+uint64_t CPU::run_frame(){
+    uint64_t instructions_done = run_until(CYCLES_PER_FRAME);
+    ppu.run_until(timestamp());
+    apu.run_until(timestamp());
+    apu.end_frame();
+    frame_cycles -= CYCLES_PER_FRAME;
+    frame_start_cycle += CYCLES_PER_FRAME;
+    return instructions_done;
+}
+
+// Called by the run loops when a branch goes backwards, with PC at its
+// target. If PC is the head of an idle loop and the last iteration left
+// everything as it found it, skips as many iterations as fit before the
+// deadline. run_until() ends its slices where the next event is due, so
+// nothing can change what the loop reads before then. Skipped iterations
+// still count towards instructions_done.
+void CPU::skip_idle_loop(uint64_t& instructions_done){
+    if(idle_loop.head != program_counter || idle_loop.generation != decode_generation){
+        analyse_idle_loop(program_counter);
+    }
+    if(!idle_loop.pollable || frame_cycles >= slice_deadline){
+        idle_loop.probed = false;
+        return;
+    }
+
+    IdleState state = idle_state();
+
+    // The body is straight-line code ending in the branch back to head, so
+    // reaching head again after exactly one body's worth of instructions
+    // means exactly one iteration ran since the probe.
+    uint64_t iteration_cycles = frame_cycles - idle_loop.cycles;
+    if(idle_loop.probed
+            && instructions_done - idle_loop.instructions_done == idle_loop.instructions
+            && state == idle_loop.state)
+    {
+        uint64_t iterations = (slice_deadline - frame_cycles) / iteration_cycles;
+        frame_cycles += iterations*iteration_cycles;
+        instructions_done += iterations*idle_loop.instructions;
+    }
+
+    idle_loop.probed = true;
+    idle_loop.state = state;
+    idle_loop.cycles = frame_cycles;
+    idle_loop.instructions_done = instructions_done;
+}
+
+// Decides whether the code at head can be skipped by skip_idle_loop(): up to
+// MAX_IDLE_LOOP_INSTRUCTIONS loads, BITs, compares and logic ops that only
+// read one address in internal RAM or PPU_STATUS, followed by a conditional
+// branch back to head. None of them write anything, and reading PPU_STATUS
+// again only clears what the previous read already cleared. Only PRG-ROM is
+// considered, since the analysis is kept until decode_generation changes.
+void CPU::analyse_idle_loop(uint16_t head){
+    idle_loop.head = head;
+    idle_loop.generation = decode_generation;
+    idle_loop.pollable = false;
+    idle_loop.probed = false;
+
+    if(head < 0x8000){
+        return;
+    }
+
+    uint16_t addr = head;
+    bool polls = false;
+    for(int i = 0; i < MAX_IDLE_LOOP_INSTRUCTIONS && addr >= 0x8000 && addr <= 0xFFFD; i++){
+        DecodedInstruction decoded;
+        decode_instruction(addr, decoded);
+        uint16_t operand = (uint16_t)decoded.operand_hi << 8 | decoded.operand_lo;
+
+        switch(decoded.opcode){
+            case LDA_ZPG: case LDX_ZPG: case LDY_ZPG: case BIT_ZPG:
+            case CMP_ZPG: case CPX_ZPG: case CPY_ZPG:
+            case AND_ZPG: case ORA_ZPG: case EOR_ZPG:
+            case LDA_ABS: case LDX_ABS: case LDY_ABS: case BIT_ABS:
+            case CMP_ABS: case CPX_ABS: case CPY_ABS:
+            case AND_ABS: case ORA_ABS: case EOR_ABS:
+                if(!(operand <= 0x1FFF || (operand <= 0x3FFF && (operand & 0x7) == 0x2))){
+                    return; // not internal RAM or a PPU_STATUS mirror
+                }
+                if(polls && operand != idle_loop.poll_addr){
+                    return;
+                }
+                polls = true;
+                idle_loop.poll_addr = operand;
+                break;
+
+            case LDA_IMM: case LDX_IMM: case LDY_IMM:
+            case CMP_IMM: case CPX_IMM: case CPY_IMM:
+            case AND_IMM: case ORA_IMM: case EOR_IMM:
+                break;
+
+            case BCC_REL: case BCS_REL: case BEQ_REL: case BMI_REL:
+            case BNE_REL: case BPL_REL: case BVC_REL: case BVS_REL:
+                // see branch(): the target is relative to the next instruction
+                if(polls && (uint16_t)(addr + 2 + (int8_t)decoded.operand_lo) == head){
+                    idle_loop.pollable = true;
+                    idle_loop.instructions = i + 1;
+                }
+                return;
+
+            default:
+                return;
+        }
+        addr += instruction_table[decoded.opcode].bytes;
+    }
+}
+
+// Everything an idle loop iteration depends on or changes
+inline CPU::IdleState CPU::idle_state(){
+    uint8_t polled;
+    if(idle_loop.poll_addr <= 0x1FFF){
+        polled = ram.internal_ram()[idle_loop.poll_addr % 0x0800];
+    }else{
+        ppu.run_until(timestamp());
+        polled = ppu.peek_status();
+    }
+    return IdleState{accumulator, index_X, index_Y, nz_result, carry_f, overflow_f, polled};
+}
+
+// the trace line is only logged at DEBUG, so batches check this once up front
+inline bool CPU::tracing(){
+    return VNES_LOG::log_level <= VNES_LOG::DEBUG || VNES_LOG::file_out;
+}
+
+// Fetches the instruction at PC and latches its operand bytes for fetch_address()
+inline const CPU::DecodedInstruction& CPU::fetch_instruction(){
+    // instructions reaching past 0xFFFF have operands in RAM, so they aren't cached
+    if(program_counter >= 0x8000 && program_counter <= 0xFFFD){
+        DecodedInstruction& decoded = decode_cache[program_counter - 0x8000];
+        if(decoded.generation != decode_generation){
+            decode_instruction(program_counter, decoded);
+            decoded.generation = decode_generation;
+        }
+        operand_lo = decoded.operand_lo;
+        operand_hi = decoded.operand_hi;
+        return decoded;
+    }
+
+    decode_instruction(program_counter, fetched);
+    operand_lo = fetched.operand_lo;
+    operand_hi = fetched.operand_hi;
+    return fetched;
+}
+
+inline void CPU::decode_instruction(uint16_t addr, DecodedInstruction& decoded){
+    uint8_t opcode = read_mem(addr);
+    const Instruction& instruction = instruction_table[opcode];
+    decoded.handler     = instruction.handler;
+    decoded.opcode      = opcode;
+    decoded.cycles      = instruction.cycles;
+    decoded.operand_lo  = (instruction.bytes > 1) ? read_mem(addr + 1) : 0;
+    decoded.operand_hi  = (instruction.bytes > 2) ? read_mem(addr + 2) : 0;
 }
 
 inline uint8_t CPU::read_mem(uint16_t addr){
-    //if(addr == 0x0180){
-    //    printf("Read from 0x0180 (PC is %x)\n", program_counter);
-    //    //do 
-    //    //{
-    //    //} while (std::cin.get() != '\n');
-    //}
+    const uint8_t* page = read_pages[addr >> 8];
+    if(page){
+        return page[addr & 0xFF];
+    }
+    return read_mmio(addr);
+}
+
+inline void CPU::write_mem(uint16_t addr, uint8_t data){
+    uint8_t* page = write_pages[addr >> 8];
+    if(page){
+        page[addr & 0xFF] = data;
+        return;
+    }
+    write_mmio(addr, data);
+}
 
+// reads from pages that aren't backed by plain memory
+uint8_t CPU::read_mmio(uint16_t addr){
     switch(addr){
         case 0x2000 ... 0x3FFF: // PPU 
+            ppu.run_until(timestamp());
             return ppu.register_read(addr);
             break;
         case 0x4014: // 0x4014 is PPU OAM register
+            ppu.run_until(timestamp());
             return ppu.register_read(addr); 
+        case 0x4015: // APU status
+            apu.run_until(timestamp());
+            return apu.register_read(addr);
         default:
             return ram.read(addr);
             break;
@@ -71,27 +411,62 @@ inline uint8_t CPU::read_mem(uint16_t addr){
 
 }
 
-inline void CPU::write_mem(uint16_t addr, uint8_t data){
-    //if(addr == 0x0180){
-    //    printf("Write to 0x0180 with data %2x (PC is %x)\n", data, program_counter);
-    //    do 
-    //    {
-    //    } while (std::cin.get() != '\n');
-    //}
-
+// writes to pages that aren't backed by plain memory
+void CPU::write_mmio(uint16_t addr, uint8_t data){
     switch(addr){
         case 0x2000 ... 0x3FFF: // PPU 
+            ppu.run_until(timestamp());
             ppu.register_write(addr, data);
+            // enabling NMI during vblank raises it straight away, and the
+            // write may have moved a PPU event before the end of the slice
+            if(scheduler.nmi_pending() || next_event_cycle() < slice_deadline){ end_slice(); }
             break;
         case 0x4014: // 0x4014 is PPU OAM register
+            ppu.run_until(timestamp());
             ppu.register_write(addr, data); 
+            frame_cycles += scheduler.take_cpu_stall(); // OAM DMA
+            if(next_event_cycle() < slice_deadline){ end_slice(); } // sprites may have moved
+            break;
+        case 0x4000 ... 0x4013: // APU
+        case 0x4015:
+        case 0x4017:
+            apu.run_until(timestamp());
+            apu.register_write(addr, data);
+            // catching up may have raised an IRQ, and the write may have
+            // moved the next one
+            if(scheduler.irq_asserted() || next_event_cycle() < slice_deadline){ end_slice(); }
             break;
         default:
+            if(addr < 0x4020){
+                ram.write(addr, data);
+                break;
+            }
+            // the PPU has to be caught up before a CHR bank switch, so the
+            // dots before the write are drawn from the old banks
+            ppu.run_until(timestamp());
             ram.write(addr, data);
+            // the mapper may have switched banks or changed ROM, retire the
+            // decoded instructions and point the pages at the new banks
+            if(ram.prg_generation() != seen_prg_generation){
+                seen_prg_generation = ram.prg_generation();
+                decode_generation++;
+                map_pages();
+            }
+            // remaps VRAM now if CHR changed, which may move sprite 0 hit
+            ppu.run_until(timestamp());
+            if(next_event_cycle() < slice_deadline){ end_slice(); }
             break;
     }
 }
 
+// Points every page that is plain memory straight at it, see read_pages
+void CPU::map_pages(){
+    for(int page = 0; page < 0x100; page++){
+        read_pages[page]  = ram.read_page(page);
+        write_pages[page] = ram.write_page(page);
+    }
+}
+
 inline void CPU::push_stack(uint8_t data){
     write_mem(stack_pointer--, data);
 }
@@ -107,7 +482,6 @@ void CPU::write_nmi_vec(uint16_t data){
 }
 
 uint16_t CPU::read_nmi_vec(){
-	VNES_LOG::LOG(VNES_LOG::WARN, "read_nmi_vec(): Check that I'm implemented correctly!");
     uint16_t data = 0;
     data |= read_mem(RAM::VEC_ADDR::NMI_VEC + 1); // HB
     data <<= 8;
@@ -155,6 +529,9 @@ void CPU::power_up(){
     VNES_LOG::LOG(VNES_LOG::WARN, "power_up(): Check that I'm implemented right!");
     interrupt_disable_f = 1;
     stack_pointer = 0x00; // reset() will decrement to 0xFD
+    cycles_since_reset = 0;
+    frame_cycles = 0;
+    frame_start_cycle = 0;
     set_status_reg(0x24);
     //program_counter = read_reset_vec();
     reset();
@@ -169,6 +546,7 @@ void CPU::reset(){
     stack_pointer -= 3;
     interrupt_disable_f = 1;
     ppu.reset();
+    apu.reset();
 }
 
 //void CPU::engage_reset(){
@@ -190,10 +568,6 @@ void CPU::raise_interrupt(bool maskable, bool from_instruction = false){
         push_stack(program_counter);
     };
 
-    if(maskable && CPU::MASKABLE_IRQ && interrupt_disable_f){
-        return;
-    }
-
     if(from_instruction){
         b_flag_f = 1;
     }else{
@@ -210,1179 +584,599 @@ void CPU::raise_interrupt(bool maskable, bool from_instruction = false){
     }else{
         program_counter = read_nmi_vec();
     }
-    frame_cycles++;
+    if(from_instruction){
+        frame_cycles++;
+    }else{
+        frame_cycles += INTERRUPT_CYCLES;
+    }
     interrupt_disable_f = 1;
 }
 
 uint8_t CPU::status_as_int(){ 
     //VNES_LOG::LOG(VNES_LOG::WARN, "status_as_int: Check that I'm implemented right!");
     uint8_t status = 0b00100000; // bit 5 is always 1
-    if(negative_f)            status |= 0b10000000;
+    if(negative_f())          status |= 0b10000000;
     if(overflow_f)            status |= 0b01000000;
     if(b_flag_f)              status |= 0b00010000;
     if(decimal_f)             status |= 0b00001000;
     if(interrupt_disable_f)   status |= 0b00000100;
-    if(zero_f)                status |= 0b00000010;
+    if(zero_f())              status |= 0b00000010;
     if(carry_f)               status |= 0b00000001;
     return status;
 }
 
 void CPU::set_status_reg(uint8_t status){
-    negative_f          = (status & 0b10000000);
     overflow_f          = (status & 0b01000000);
     b_flag_f            = (status & 0b00010000);
     decimal_f           = (status & 0b00001000);
     interrupt_disable_f = (status & 0b00000100);
-    zero_f              = (status & 0b00000010);
+    nz_result           = ((status & 0b10000000) << 1) | (~status & 0b00000010); // see set_nz()
     carry_f             = (status & 0b00000001);
 }
 
-void CPU::add_cycle_if_page_crossed(uint16_t base_addr, 
-                                    uint16_t offset, 
-                                    CPU::ADDRESSING_MODE mode,
-                                    const AddrModeVec& modes){
-    bool check_in_this_mode = (std::find(modes.begin(), modes.end(), mode) != modes.end());
-    if(check_in_this_mode){
-        uint16_t result_addr = base_addr + offset;
-        base_addr &= 0xF0;
-        result_addr &= 0xF0;
-        if(base_addr != result_addr){
-            // page crossed
-            frame_cycles++;
-        }
+void CPU::add_cycle_if_page_crossed(uint16_t base_addr, uint16_t offset){
+    uint16_t result_addr = base_addr + offset;
+    base_addr &= 0xF0;
+    result_addr &= 0xF0;
+    if(base_addr != result_addr){
+        // page crossed
+        frame_cycles++;
     }
 }
 
 // TODO: verify that page wrapping / page crossing is implemented correctly
-uint16_t CPU::fetch_address(enum ADDRESSING_MODE mode, const AddrModeVec& page_crossing_modes = AddrModeVec{}){
-    using namespace VNES_LOG;
+// The addressing mode and page crossing policy are template parameters, so
+// every instantiation compiles down to just the address arithmetic for its
+// mode. The operand bytes were already latched by fetch_instruction().
+template<CPU::ADDRESSING_MODE mode, CPU::PAGE_CROSSING page_crossing>
+inline uint16_t CPU::fetch_address(){
+    // The accumulator is not in RAM and implied instructions have no operand,
+    // so instructions in these modes never fetch an address
+    static_assert(mode != ACC && mode != IMPL, "Tried to fetch address in Accumulator or Implied mode");
+
+    constexpr bool penalize = (page_crossing == ADD_CYCLE_ON_PAGE_CROSS);
     uint16_t addr = 0;
-    //uint8_t zpg_ptr = 0; // a pointer into the zero page is sometimes needed
     uint16_t zpg_ptr = 0; // a pointer into the zero page is sometimes needed
-    uint16_t ptr = 0; // pointer for INDIRECT
-    (void)ptr;
-    switch(mode){
-        case ACC:
-            addr = 0; // The accumulator is not in RAM.
-                      // Instructions which work on the accumulator should not attempt to
-                      // access RAM
-            LOG(ERROR, "Tried to fetch address while in Accumulator mode. This attempt shouldn't happen!\n");
-			break;
-		case ABS:
-            // ABS has low, then high byte of programmer's desired address at PC+1 and PC+2
-            addr |= read_mem(++program_counter);
-            addr |= ((uint16_t)read_mem(++program_counter) << 8);
-			break;
-		case ABSX:
-            addr |= read_mem(++program_counter);
-            addr |= ((uint16_t)read_mem(++program_counter) << 8);
-            add_cycle_if_page_crossed(addr, index_X, mode, page_crossing_modes);
-            addr += index_X;
-			break;
-		case ABSY:
-            addr |= read_mem(++program_counter);
-            addr |= ((uint16_t)read_mem(++program_counter) << 8);
-            add_cycle_if_page_crossed(addr, index_Y, mode, page_crossing_modes);
-            addr += index_Y;
-			break;
-		case IMM:
-            addr = ++program_counter;
-			break;
-		case IMPL:
-            addr = 0; // Implicit addressing never needs to fetch an address
-            LOG(ERROR, "Tried to fetch address while in Implied mode. This attempt shouldn't happen!\n");
-			break;
-		case IND:
-            //ptr = read_mem(++program_counter);
-            //ptr |= read_mem(++program_counter) << 8;
-            //addr = read_mem(ptr);
-            //addr |= read_mem(++ptr) << 8;
-            zpg_ptr = read_mem(++program_counter);
-            addr |= read_mem(zpg_ptr);
-            addr |= (read_mem(++zpg_ptr) << 8);
-			break;
-		case INDX:
-            zpg_ptr = read_mem(++program_counter);
-            zpg_ptr += index_X;
-            addr |= read_mem(zpg_ptr);
-            addr |= (read_mem(++zpg_ptr) << 8);
-			break;
-		case INDY:
-            zpg_ptr = read_mem(++program_counter);
-            add_cycle_if_page_crossed(zpg_ptr, index_Y, mode, page_crossing_modes);
-            zpg_ptr += index_Y;
-            addr |= read_mem(zpg_ptr);
-            addr |= (read_mem(++zpg_ptr) << 8);
-			break;
-		case REL:
-            addr = read_mem(++program_counter);
-			break;
-		case ZPG:
-            addr |= read_mem(++program_counter);
-			break;
-		case ZPGX:
-            addr |= read_mem(++program_counter);
-            addr += index_X;
-			break;
-		case ZPGY:
-            addr |= read_mem(++program_counter);
-            addr += index_Y;
-			break;
-        default:
-            LOG(FATAL, "Tried to fetch address with bad addressing mode! Bad mode was %c", mode);
-            VNES_ASSERT(0 && "Unreachable");
-            break;
+
+    if constexpr(mode == ABS){
+        // ABS has low, then high byte of programmer's desired address at PC+1 and PC+2
+        addr = (uint16_t)operand_hi << 8 | operand_lo;
+        program_counter += 2;
+    }else if constexpr(mode == ABSX){
+        addr = (uint16_t)operand_hi << 8 | operand_lo;
+        program_counter += 2;
+        if constexpr(penalize){ add_cycle_if_page_crossed(addr, index_X); }
+        addr += index_X;
+    }else if constexpr(mode == ABSY){
+        addr = (uint16_t)operand_hi << 8 | operand_lo;
+        program_counter += 2;
+        if constexpr(penalize){ add_cycle_if_page_crossed(addr, index_Y); }
+        addr += index_Y;
+    }else if constexpr(mode == IMM){
+        addr = ++program_counter;
+    }else if constexpr(mode == IND){
+        zpg_ptr = operand_lo;
+        program_counter++;
+        addr |= read_mem(zpg_ptr);
+        addr |= (read_mem(++zpg_ptr) << 8);
+    }else if constexpr(mode == INDX){
+        zpg_ptr = operand_lo;
+        program_counter++;
+        zpg_ptr += index_X;
+        addr |= read_mem(zpg_ptr);
+        addr |= (read_mem(++zpg_ptr) << 8);
+    }else if constexpr(mode == INDY){
+        zpg_ptr = operand_lo;
+        program_counter++;
+        if constexpr(penalize){ add_cycle_if_page_crossed(zpg_ptr, index_Y); }
+        zpg_ptr += index_Y;
+        addr |= read_mem(zpg_ptr);
+        addr |= (read_mem(++zpg_ptr) << 8);
+    }else if constexpr(mode == REL){
+        addr = operand_lo;
+        program_counter++;
+    }else if constexpr(mode == ZPG){
+        addr = operand_lo;
+        program_counter++;
+    }else if constexpr(mode == ZPGX){
+        addr = operand_lo;
+        program_counter++;
+        addr += index_X;
+    }else if constexpr(mode == ZPGY){
+        addr = operand_lo;
+        program_counter++;
+        addr += index_Y;
     }
-    if(addr % 0x0800 == 0x0180) { printf("Addr 0x%x mirrors or is 0x0180\n", addr); }
     return addr;
 }
 
-// returns cycles passed
-int CPU::execute_instruction(uint8_t instruction){
-    std::stringstream ss {};
-    ss << (OPCODE)instruction;
-    VNES_LOG::LOG(VNES_LOG::DEBUG, "Executing instruction %s", ss.str().c_str());
-    switch(instruction){
-        /* Load/Store */
-        case LDA_INDX:    // Load Accumulator 	N,Z
-            LDA(INDX);
-            frame_cycles += 6;
-            break;
-        case LDA_ZPG:    
-            LDA(ZPG);
-            frame_cycles += 3;
-            break;
-        case LDA_IMM:    
-            LDA(IMM);
-            frame_cycles += 2;
-            break;
-        case LDA_ABS:    
-            LDA(ABS);
-            frame_cycles += 4;
-            break;
-        case LDA_INDY:    
-            frame_cycles += 5;
-            LDA(INDY);
-            break;
-        case LDA_ZPGX:    
-            LDA(ZPGX);
-            frame_cycles += 4;
-            break;
-        case LDA_ABSY:    
-            LDA(ABSY);
-            frame_cycles += 4;
-            break;
-        case LDA_ABSX:    
-            LDA(ABSX);
-            frame_cycles += 4;
-            break;
-        case LDX_IMM: 	// Load X Register 	    N,Z
-            LDX(IMM);
-            frame_cycles += 2;
-            break;
-        case LDX_ZPG: 	
-            LDX(ZPG);
-            frame_cycles += 3;
-            break;
-        case LDX_ABS: 	
-            LDX(ABS);
-            frame_cycles += 4;
-            break;
-        case LDX_ZPGY: 	
-            LDX(ZPGY);
-            frame_cycles += 4;
-            break;
-        case LDX_ABSY: 	
-            LDX(ABSY);
-            frame_cycles += 4;
-            break;
-        case LDY_IMM: 	// Load Y Register 	    N,Z
-            LDY(IMM);
-            frame_cycles += 2;
-            break;
-        case LDY_ZPG: 	
-            LDY(ZPG);
-            frame_cycles += 3;
-            break;
-        case LDY_ABS: 	
-            LDY(ABS);
-            frame_cycles += 4;
-            break;
-        case LDY_ZPGX: 	
-            LDY(ZPGX);
-            frame_cycles += 4;
-            break;
-        case LDY_ABSX: 	
-            LDY(ABSX);
-            frame_cycles += 4;
-            break;
-        case STA_INDX: 	// Store Accumulator 	 
-            STA(INDX);
-            frame_cycles += 6;
-            break;
-        case STA_ZPG: 	 	 
-            STA(ZPG);
-            frame_cycles += 3;
-            break;
-        case STA_ABS: 	 	 
-            STA(ABS);
-            frame_cycles += 4;
-            break;
-        case STA_INDY: 	 	 
-            STA(INDY);
-            frame_cycles += 6;
-            break;
-        case STA_ZPGX: 	 	 
-            STA(ZPGX);
-            frame_cycles += 4;
-            break;
-        case STA_ABSY: 	 	 
-            STA(ABSY);
-            frame_cycles += 5;
-            break;
-        case STA_ABSX: 	 	 
-            STA(ABSX);
-            frame_cycles += 5;
-            break;
-        case STX_ZPG: 	// Store X Register 	 
-            STX(ZPG);
-            frame_cycles += 3;
-            break;
-        case STX_ABS: 	 	 
-            STX(ABS);
-            frame_cycles += 4;
-            break;
-        case STX_ZPGY: 	 	 
-            STX(ZPGY);
-            frame_cycles += 4;
-            break;
-        case STY_ZPG: 	// Store Y Register 	 
-            STY(ZPG);
-            frame_cycles += 3;
-            break;
-        case STY_ABS: 	 	 
-            STY(ABS);
-            frame_cycles += 4;
-            break;
-        case STY_ZPGX: 	 	 
-            STY(ZPGX);
-            frame_cycles += 4;
-            break;
-
-        /* Register Transfers */
-        case TAX_IMPL: 	    // Transfer accumulator to X 	N,Z
-            TAX();
-            frame_cycles += 2;
-			break;
-        case TAY_IMPL: 	    // Transfer accumulator to Y 	N,Z
-            TAY();
-            frame_cycles += 2;
-			break;
-        case TXA_IMPL: 	    // Transfer X to accumulator 	N,Z
-            TXA();
-            frame_cycles += 2;
-			break;
-        case TYA_IMPL: 	    // Transfer Y to accumulator 	N,Z
-            TYA();
-            frame_cycles += 2;
-            break;
-
-        /* Stack Operations */
-        case TSX_IMPL: 	    // Transfer stack pointer to X 	    N,Z
-            TSX();
-            frame_cycles += 2;
-			break;
-        case TXS_IMPL: 	    // Transfer X to stack pointer 	 
-            TXS();
-            frame_cycles += 2;
-			break;
-        case PHA_IMPL: 	    // Push accumulator on stack 	 
-            PHA();
-            frame_cycles += 3;
-			break;
-        case PHP_IMPL: 	    // Push processor status on stack 	 
-            PHP();
-            frame_cycles += 3;
-			break;
-        case PLA_IMPL: 	    // Pull accumulator from stack 	    N,Z
-            PLA();
-            frame_cycles += 4;
-			break;
-        case PLP_IMPL: 	    // Pull processor status from stack All
-            PLP();
-            frame_cycles += 4;
-            break;
+// Reads the operand of the current instruction. Immediates come straight from
+// the latched operand byte instead of being read back through the bus.
+template<CPU::ADDRESSING_MODE mode, CPU::PAGE_CROSSING page_crossing>
+inline uint8_t CPU::fetch_operand(){
+    if constexpr(mode == IMM){
+        program_counter++;
+        return operand_lo;
+    }else{
+        return read_mem(fetch_address<mode, page_crossing>());
+    }
+}
 
-        /* Logical */
-        case AND_INDX: 	    // Logical AND 	            N,Z
-            AND(INDX);
-            frame_cycles += 6;
-            break;
-        case AND_ZPG: 	    
-            AND(ZPG);
-            frame_cycles += 3;
-            break;
-        case AND_IMM: 	    
-            AND(IMM);
-            frame_cycles += 2;
-            break;
-        case AND_ABS: 	    
-            AND(ABS);
-            frame_cycles += 4;
-            break;
-        case AND_INDY: 	    
-            AND(INDY);
-            frame_cycles += 5;
-            break;
-        case AND_ZPGX: 	    
-            AND(ZPGX);
-            frame_cycles += 4;
-            break;
-        case AND_ABSY: 	    
-            AND(ABSY);
-            frame_cycles += 4;
-            break;
-        case AND_ABSX: 	    
-            AND(ABSX);
-            frame_cycles += 4;
-            break;
-        case EOR_INDX: 	    // Exclusive OR     N,Z
-            EOR(INDX);
-            frame_cycles += 6;
-            break;
-        case EOR_ZPG: 	    
-            EOR(ZPG);
-            frame_cycles += 3;
-            break;
-        case EOR_IMM: 	    
-            EOR(IMM);
-            frame_cycles += 2;
-            break;
-        case EOR_ABS: 	    
-            EOR(ABS);
-            frame_cycles += 4;
-            break;
-        case EOR_INDY: 	    
-            EOR(INDY);
-            frame_cycles += 5;
-            break;
-        case EOR_ZPGX: 	    
-            EOR(ZPGX);
-            frame_cycles += 4;
-            break;
-        case EOR_ABSY: 	    
-            frame_cycles += 4;
-            EOR(ABSY);
-            break;
-        case EOR_ABSX: 	    
-            EOR(ABSX);
-            frame_cycles += 4;
-            break;
-        case ORA_INDX: 	    // Logical Inclusive OR 	N,Z
-            ORA(INDX);
-            frame_cycles += 6;
-            break;
-        case ORA_ZPG: 	    
-            ORA(ZPG);
-            frame_cycles += 3;
-            break;
-        case ORA_IMM: 	    
-            ORA(IMM);
-            frame_cycles += 2;
-            break;
-        case ORA_ABS: 	    
-            ORA(ABS);
-            frame_cycles += 4;
-            break;
-        case ORA_INDY: 	    
-            ORA(INDY);
-            frame_cycles += 5;
-            break;
-        case ORA_ZPGX: 	    
-            ORA(ZPGX);
-            frame_cycles += 4;
-            break;
-        case ORA_ABSY: 	    
-            ORA(ABSY);
-            frame_cycles += 4;
-            break;
-        case ORA_ABSX: 	    
-            ORA(ABSX);
-            frame_cycles += 4;
-            break;
-        case BIT_ZPG: 	    // Bit Test 	            N,V,Z
-            BIT(ZPG);
-            frame_cycles += 3;
-            break;
-        case BIT_ABS: 	    
-            BIT(ABS);
-            frame_cycles += 4;
-            break;
+constexpr uint8_t CPU::instruction_bytes(enum ADDRESSING_MODE mode){
+    switch(mode){
+        case ACC:
+        case IMPL:
+            return 1;
+        case ABS:
+        case ABSX:
+        case ABSY:
+        case IND:
+            return 3;
+        default:
+            return 2; // one operand byte
+    }
+}
 
-        /* Arithmetic */
-        case ADC_INDX: 	    // Add with Carry 	    N,V,Z,C 
-            ADC(INDX);
-            frame_cycles += 6;
-            break;
-        case ADC_ZPG: 	    
-            ADC(ZPG);
-            frame_cycles += 3;
-            break;
-        case ADC_IMM: 	    
-            ADC(IMM);
-            frame_cycles += 2;
-            break;
-        case ADC_ABS: 	    
-            ADC(ABS);
-            frame_cycles += 4;
-            break;
-        case ADC_INDY: 	    
-            ADC(INDY);
-            frame_cycles += 5;
-            break;
-        case ADC_ZPGX: 	    
-            ADC(ZPGX);
-            frame_cycles += 4;
-            break;
-        case ADC_ABSY: 	    
-            ADC(ABSY);
-            frame_cycles += 4;
-            break;
-        case ADC_ABSX: 	    
-            ADC(ABSX);
-            frame_cycles += 4;
-            break;
-        case SBC_INDX: 	    // Subtract with Carry 	N,V,Z,C
-            SBC(INDX);
-            frame_cycles += 6;
-            break;
-        case SBC_ZPG: 	    
-            SBC(ZPG);
-            frame_cycles += 3;
-            break;
-        case SBC_IMM: 	    
-            SBC(IMM);
-            frame_cycles += 2;
-            break;
-        case SBC_ABS: 	    
-            SBC(ABS);
-            frame_cycles += 4;
-            break;
-        case SBC_INDY: 	    
-            SBC(INDY);
-            frame_cycles += 5;
-            break;
-        case SBC_ZPGX: 	    
-            SBC(ZPGX);
-            frame_cycles += 4;
-            break;
-        case SBC_ABSY: 	    
-            SBC(ABSY);
-            frame_cycles += 4;
-            break;
-        case SBC_ABSX: 	    
-            SBC(ABSX);
-            frame_cycles += 4;
-            break;
-        case CMP_INDX: 	    // Compare accumulator 	N,Z,C
-            CMP(INDX);
-            frame_cycles += 6;
-            break;
-        case CMP_ZPG: 	    
-            CMP(ZPG);
-            frame_cycles += 3;
-            break;
-        case CMP_IMM: 	    
-            CMP(IMM);
-            frame_cycles += 2;
-            break;
-        case CMP_ABS: 	    
-            CMP(ABS);
-            frame_cycles += 4;
-            break;
-        case CMP_INDY: 	    
-            CMP(INDY);
-            frame_cycles += 5;
-            break;
-        case CMP_ZPGX: 	    
-            CMP(ZPGX);
-            frame_cycles += 4;
-            break;
-        case CMP_ABSY: 	    
-            CMP(ABSY);
-            frame_cycles += 4;
-            break;
-        case CMP_ABSX: 	    
-            CMP(ABSX);
-            frame_cycles += 4;
-            break;
-        case CPX_IMM: 	    // Compare X register 	N,Z,C
-            CPX(IMM);
-            frame_cycles += 2;
-            break;
-        case CPX_ZPG: 	    
-            CPX(ZPG);
-            frame_cycles += 3;
-            break;
-        case CPX_ABS: 	    
-            CPX(ABS);
-            frame_cycles += 4;
-            break;
-        case CPY_IMM: 	    // Compare Y register 	N,Z,C
-            CPY(IMM);
-            frame_cycles += 2;
-            break;
-        case CPY_ZPG: 	    
-            CPY(ZPG);
-            frame_cycles += 3;
-            break;
-        case CPY_ABS: 	    
-            CPY(ABS);
-            frame_cycles += 4;
-            break;
+constexpr std::array<CPU::Instruction, 256> CPU::build_instruction_table(){
+    std::array<Instruction, 256> table {};
+
+    // MODE_OP entries use the handler instantiated for their addressing mode,
+    // FIXED_OP handlers only support one mode (the mode is kept for byte length and tracing).
+    // Page crossing penalties are up to the handlers, see fetch_operand()
+    #define MODE_OP(opcode, op, mode, cycles) \
+        table[opcode] = Instruction{&CPU::op<mode>, mode, cycles, instruction_bytes(mode), #opcode}
+    #define FIXED_OP(opcode, op, mode, cycles) \
+        table[opcode] = Instruction{&CPU::op, mode, cycles, instruction_bytes(mode), #opcode}
+
+    /* Load/Store */
+    MODE_OP (LDA_INDX,       LDA,  INDX, 6);
+    MODE_OP (LDA_ZPG,        LDA,  ZPG,  3);
+    MODE_OP (LDA_IMM,        LDA,  IMM,  2);
+    MODE_OP (LDA_ABS,        LDA,  ABS,  4);
+    MODE_OP (LDA_INDY,       LDA,  INDY, 5);
+    MODE_OP (LDA_ZPGX,       LDA,  ZPGX, 4);
+    MODE_OP (LDA_ABSY,       LDA,  ABSY, 4);
+    MODE_OP (LDA_ABSX,       LDA,  ABSX, 4);
+    MODE_OP (LDX_IMM,        LDX,  IMM,  2);
+    MODE_OP (LDX_ZPG,        LDX,  ZPG,  3);
+    MODE_OP (LDX_ABS,        LDX,  ABS,  4);
+    MODE_OP (LDX_ZPGY,       LDX,  ZPGY, 4);
+    MODE_OP (LDX_ABSY,       LDX,  ABSY, 4);
+    MODE_OP (LDY_IMM,        LDY,  IMM,  2);
+    MODE_OP (LDY_ZPG,        LDY,  ZPG,  3);
+    MODE_OP (LDY_ABS,        LDY,  ABS,  4);
+    MODE_OP (LDY_ZPGX,       LDY,  ZPGX, 4);
+    MODE_OP (LDY_ABSX,       LDY,  ABSX, 4);
+    MODE_OP (STA_INDX,       STA,  INDX, 6);
+    MODE_OP (STA_ZPG,        STA,  ZPG,  3);
+    MODE_OP (STA_ABS,        STA,  ABS,  4);
+    MODE_OP (STA_INDY,       STA,  INDY, 6);
+    MODE_OP (STA_ZPGX,       STA,  ZPGX, 4);
+    MODE_OP (STA_ABSY,       STA,  ABSY, 5);
+    MODE_OP (STA_ABSX,       STA,  ABSX, 5);
+    MODE_OP (STX_ZPG,        STX,  ZPG,  3);
+    MODE_OP (STX_ABS,        STX,  ABS,  4);
+    MODE_OP (STX_ZPGY,       STX,  ZPGY, 4);
+    MODE_OP (STY_ZPG,        STY,  ZPG,  3);
+    MODE_OP (STY_ABS,        STY,  ABS,  4);
+    MODE_OP (STY_ZPGX,       STY,  ZPGX, 4);
+
+    /* Register Transfers */
+    FIXED_OP(TAX_IMPL,       TAX,               IMPL, 2);
+    FIXED_OP(TAY_IMPL,       TAY,               IMPL, 2);
+    FIXED_OP(TXA_IMPL,       TXA,               IMPL, 2);
+    FIXED_OP(TYA_IMPL,       TYA,               IMPL, 2);
+
+    /* Stack Operations */
+    FIXED_OP(TSX_IMPL,       TSX,               IMPL, 2);
+    FIXED_OP(TXS_IMPL,       TXS,               IMPL, 2);
+    FIXED_OP(PHA_IMPL,       PHA,               IMPL, 3);
+    FIXED_OP(PHP_IMPL,       PHP,               IMPL, 3);
+    FIXED_OP(PLA_IMPL,       PLA,               IMPL, 4);
+    FIXED_OP(PLP_IMPL,       PLP,               IMPL, 4);
+
+    /* Logical */
+    MODE_OP (AND_INDX,       AND,  INDX, 6);
+    MODE_OP (AND_ZPG,        AND,  ZPG,  3);
+    MODE_OP (AND_IMM,        AND,  IMM,  2);
+    MODE_OP (AND_ABS,        AND,  ABS,  4);
+    MODE_OP (AND_INDY,       AND,  INDY, 5);
+    MODE_OP (AND_ZPGX,       AND,  ZPGX, 4);
+    MODE_OP (AND_ABSY,       AND,  ABSY, 4);
+    MODE_OP (AND_ABSX,       AND,  ABSX, 4);
+    MODE_OP (EOR_INDX,       EOR,  INDX, 6);
+    MODE_OP (EOR_ZPG,        EOR,  ZPG,  3);
+    MODE_OP (EOR_IMM,        EOR,  IMM,  2);
+    MODE_OP (EOR_ABS,        EOR,  ABS,  4);
+    MODE_OP (EOR_INDY,       EOR,  INDY, 5);
+    MODE_OP (EOR_ZPGX,       EOR,  ZPGX, 4);
+    MODE_OP (EOR_ABSY,       EOR,  ABSY, 4);
+    MODE_OP (EOR_ABSX,       EOR,  ABSX, 4);
+    MODE_OP (ORA_INDX,       ORA,  INDX, 6);
+    MODE_OP (ORA_ZPG,        ORA,  ZPG,  3);
+    MODE_OP (ORA_IMM,        ORA,  IMM,  2);
+    MODE_OP (ORA_ABS,        ORA,  ABS,  4);
+    MODE_OP (ORA_INDY,       ORA,  INDY, 5);
+    MODE_OP (ORA_ZPGX,       ORA,  ZPGX, 4);
+    MODE_OP (ORA_ABSY,       ORA,  ABSY, 4);
+    MODE_OP (ORA_ABSX,       ORA,  ABSX, 4);
+    MODE_OP (BIT_ZPG,        BIT,  ZPG,  3);
+    MODE_OP (BIT_ABS,        BIT,  ABS,  4);
+
+    /* Arithmetic */
+    MODE_OP (ADC_INDX,       ADC,  INDX, 6);
+    MODE_OP (ADC_ZPG,        ADC,  ZPG,  3);
+    MODE_OP (ADC_IMM,        ADC,  IMM,  2);
+    MODE_OP (ADC_ABS,        ADC,  ABS,  4);
+    MODE_OP (ADC_INDY,       ADC,  INDY, 5);
+    MODE_OP (ADC_ZPGX,       ADC,  ZPGX, 4);
+    MODE_OP (ADC_ABSY,       ADC,  ABSY, 4);
+    MODE_OP (ADC_ABSX,       ADC,  ABSX, 4);
+    MODE_OP (SBC_INDX,       SBC,  INDX, 6);
+    MODE_OP (SBC_ZPG,        SBC,  ZPG,  3);
+    MODE_OP (SBC_IMM,        SBC,  IMM,  2);
+    MODE_OP (SBC_ABS,        SBC,  ABS,  4);
+    MODE_OP (SBC_INDY,       SBC,  INDY, 5);
+    MODE_OP (SBC_ZPGX,       SBC,  ZPGX, 4);
+    MODE_OP (SBC_ABSY,       SBC,  ABSY, 4);
+    MODE_OP (SBC_ABSX,       SBC,  ABSX, 4);
+    MODE_OP (CMP_INDX,       CMP,  INDX, 6);
+    MODE_OP (CMP_ZPG,        CMP,  ZPG,  3);
+    MODE_OP (CMP_IMM,        CMP,  IMM,  2);
+    MODE_OP (CMP_ABS,        CMP,  ABS,  4);
+    MODE_OP (CMP_INDY,       CMP,  INDY, 5);
+    MODE_OP (CMP_ZPGX,       CMP,  ZPGX, 4);
+    MODE_OP (CMP_ABSY,       CMP,  ABSY, 4);
+    MODE_OP (CMP_ABSX,       CMP,  ABSX, 4);
+    MODE_OP (CPX_IMM,        CPX,  IMM,  2);
+    MODE_OP (CPX_ZPG,        CPX,  ZPG,  3);
+    MODE_OP (CPX_ABS,        CPX,  ABS,  4);
+    MODE_OP (CPY_IMM,        CPY,  IMM,  2);
+    MODE_OP (CPY_ZPG,        CPY,  ZPG,  3);
+    MODE_OP (CPY_ABS,        CPY,  ABS,  4);
+
+    /* Increments & Decrements */
+    MODE_OP (INC_ZPG,        INC,  ZPG,  5);
+    MODE_OP (INC_ABS,        INC,  ABS,  6);
+    MODE_OP (INC_ZPGX,       INC,  ZPGX, 6);
+    MODE_OP (INC_ABSX,       INC,  ABSX, 7);
+    FIXED_OP(INX_IMPL,       INX,               IMPL, 2);
+    FIXED_OP(INY_IMPL,       INY,               IMPL, 2);
+    MODE_OP (DEC_ZPG,        DEC,  ZPG,  5);
+    MODE_OP (DEC_ABS,        DEC,  ABS,  6);
+    MODE_OP (DEC_ZPGX,       DEC,  ZPGX, 6);
+    MODE_OP (DEC_ABSX,       DEC,  ABSX, 7);
+    FIXED_OP(DEX_IMPL,       DEX,               IMPL, 2);
+    FIXED_OP(DEY_IMPL,       DEY,               IMPL, 2);
+
+    /* Shifts */
+    MODE_OP (ASL_ZPG,        ASL,  ZPG,  5);
+    FIXED_OP(ASL_ACC,        ASL_eACC,          ACC,  2);
+    MODE_OP (ASL_ABS,        ASL,  ABS,  6);
+    MODE_OP (ASL_ZPGX,       ASL,  ZPGX, 6);
+    MODE_OP (ASL_ABSX,       ASL,  ABSX, 7);
+    MODE_OP (LSR_ZPG,        LSR,  ZPG,  5);
+    FIXED_OP(LSR_ACC,        LSR_eACC,          ACC,  2);
+    MODE_OP (LSR_ABS,        LSR,  ABS,  6);
+    MODE_OP (LSR_ZPGX,       LSR,  ZPGX, 6);
+    MODE_OP (LSR_ABSX,       LSR,  ABSX, 7);
+    MODE_OP (ROL_ZPG,        ROL,  ZPG,  5);
+    FIXED_OP(ROL_ACC,        ROL_eACC,          ACC,  2);
+    MODE_OP (ROL_ABS,        ROL,  ABS,  6);
+    MODE_OP (ROL_ZPGX,       ROL,  ZPGX, 6);
+    MODE_OP (ROL_ABSX,       ROL,  ABSX, 7);
+    MODE_OP (ROR_ZPG,        ROR,  ZPG,  5);
+    FIXED_OP(ROR_ACC,        ROR_eACC,          ACC,  2);
+    MODE_OP (ROR_ABS,        ROR,  ABS,  6);
+    MODE_OP (ROR_ZPGX,       ROR,  ZPGX, 6);
+    MODE_OP (ROR_ABSX,       ROR,  ABSX, 7);
+
+    /* Jumps & Calls */
+    MODE_OP (JMP_ABS,        JMP,  ABS,  3);
+    MODE_OP (JMP_IND,        JMP,  IND,  5);
+    FIXED_OP(JSR_ABS,        JSR,               ABS,  6);
+    FIXED_OP(RTS_IMPL,       RTS,               IMPL, 6);
+
+    /* Branches */
+    FIXED_OP(BCC_REL,        BCC,               REL,  2);
+    FIXED_OP(BCS_REL,        BCS,               REL,  2);
+    FIXED_OP(BEQ_REL,        BEQ,               REL,  2);
+    FIXED_OP(BMI_REL,        BMI,               REL,  2);
+    FIXED_OP(BNE_REL,        BNE,               REL,  2);
+    FIXED_OP(BPL_REL,        BPL,               REL,  2);
+    FIXED_OP(BVC_REL,        BVC,               REL,  2);
+    FIXED_OP(BVS_REL,        BVS,               REL,  2);
+
+    /* Status Flag Changes */
+    FIXED_OP(CLC_IMPL,       CLC,               IMPL, 2);
+    FIXED_OP(CLD_IMPL,       CLD,               IMPL, 2);
+    FIXED_OP(CLI_IMPL,       CLI,               IMPL, 2);
+    FIXED_OP(CLV_IMPL,       CLV,               IMPL, 2);
+    FIXED_OP(SEC_IMPL,       SEC,               IMPL, 2);
+    FIXED_OP(SED_IMPL,       SED,               IMPL, 2);
+    FIXED_OP(SEI_IMPL,       SEI,               IMPL, 2);
+
+    /* System Functions */
+    FIXED_OP(BRK_IMPL,       BRK,               IMPL, 7);
+    FIXED_OP(NOP_IMPL,       NOP,               IMPL, 1);
+    FIXED_OP(RTI_IMPL,       RTI,               IMPL, 6);
+
+    /* Unofficial/Illegal opcodes */
+
+    /* Illegal NOP's */
+    FIXED_OP(NOP_IMM_ILL0,   UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(NOP_IMM_ILL1,   UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(NOP_IMM_ILL2,   UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(NOP_IMM_ILL3,   UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(NOP_IMM_ILL4,   UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(NOP_ZPG_ILL0,   UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(NOP_ZPG_ILL1,   UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(NOP_ZPG_ILL2,   UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(NOP_ZPGX_ILL0,  UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(NOP_ZPGX_ILL1,  UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(NOP_ZPGX_ILL2,  UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(NOP_ZPGX_ILL3,  UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(NOP_ZPGX_ILL4,  UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(NOP_ZPGX_ILL5,  UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(NOP_IMPL_ILL0,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(NOP_IMPL_ILL1,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(NOP_IMPL_ILL2,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(NOP_IMPL_ILL3,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(NOP_IMPL_ILL4,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(NOP_IMPL_ILL5,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(NOP_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(NOP_ABSX_ILL0,  UNIMPLEMENTED_ILL, ABSX, 0);
+    FIXED_OP(NOP_ABSX_ILL1,  UNIMPLEMENTED_ILL, ABSX, 0);
+    FIXED_OP(NOP_ABSX_ILL2,  UNIMPLEMENTED_ILL, ABSX, 0);
+    FIXED_OP(NOP_ABSX_ILL3,  UNIMPLEMENTED_ILL, ABSX, 0);
+    FIXED_OP(NOP_ABSX_ILL4,  UNIMPLEMENTED_ILL, ABSX, 0);
+    FIXED_OP(NOP_ABSX_ILL5,  UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* JAM instructions cause the CPU to loop/halt indefinitely */
+    FIXED_OP(JAM_IMPL_ILL0,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL1,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL2,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL3,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL4,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL5,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL6,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL7,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL8,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL9,  UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL10, UNIMPLEMENTED_ILL, IMPL, 0);
+    FIXED_OP(JAM_IMPL_ILL11, UNIMPLEMENTED_ILL, IMPL, 0);
+
+    // TODO: compile remaining illegal opcodes
+
+    /* SLO = ASL combined with ORA */
+    FIXED_OP(SLO_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(SLO_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(SLO_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(SLO_ZPGX_ILL,   UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(SLO_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(SLO_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(SLO_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* RLA = AND combined with ROL */
+    FIXED_OP(RLA_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(RLA_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(RLA_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(RLA_ZPGX_ILL,   UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(RLA_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(RLA_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(RLA_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* SRE = LSR combined with EOR */
+    FIXED_OP(SRE_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(SRE_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(SRE_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(SRE_ZPGX_ILL,   UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(SRE_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(SRE_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(SRE_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* RRA = ROR combined with ADC */
+    FIXED_OP(RRA_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(RRA_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(RRA_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(RRA_ZPGX_ILL,   UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(RRA_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(RRA_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(RRA_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* SAX */
+    FIXED_OP(SAX_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(SAX_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(SAX_ZPGY_ILL,   UNIMPLEMENTED_ILL, ZPGY, 0);
+    FIXED_OP(SAX_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+
+    /* LAX = LDA combined with LDX */
+    FIXED_OP(LAX_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(LAX_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(LAX_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(LAX_ZPGY_ILL,   UNIMPLEMENTED_ILL, ZPGY, 0);
+    FIXED_OP(LAX_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(LAX_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+
+    /* DCP = LDA combined with TSX */
+    FIXED_OP(DCP_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(DCP_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(DCP_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(DCP_ZPGX_ILL,   UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(DCP_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(DCP_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(DCP_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* ISC = INC combined with SBC */
+    FIXED_OP(ISC_INDX_ILL,   UNIMPLEMENTED_ILL, INDX, 0);
+    FIXED_OP(ISC_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(ISC_ZPG_ILL,    UNIMPLEMENTED_ILL, ZPG,  0);
+    FIXED_OP(ISC_ZPGX_ILL,   UNIMPLEMENTED_ILL, ZPGX, 0);
+    FIXED_OP(ISC_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(ISC_ABS_ILL,    UNIMPLEMENTED_ILL, ABS,  0);
+    FIXED_OP(ISC_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+
+    /* ANC = AND combined with set C */
+    FIXED_OP(ANC_IMM_ILL0,   ANC_ILL,           IMM,  2);
+    FIXED_OP(ANC_IMM_ILL1,   UNIMPLEMENTED_ILL, IMM,  0);
+
+    // misc
+    FIXED_OP(ALR_IMM_ILL,    UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(ARR_IMM_ILL,    UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(ANE_IMM_ILL,    UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(SHA_INDY_ILL,   UNIMPLEMENTED_ILL, INDY, 0);
+    FIXED_OP(SHA_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(SHY_ABSX_ILL,   UNIMPLEMENTED_ILL, ABSX, 0);
+    FIXED_OP(SHX_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(TAS_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(LXA_IMM_ILL,    UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(LAS_ABSY_ILL,   UNIMPLEMENTED_ILL, ABSY, 0);
+    FIXED_OP(SBX_IMM_ILL,    UNIMPLEMENTED_ILL, IMM,  0);
+    FIXED_OP(USBC_IMM_ILL,   UNIMPLEMENTED_ILL, IMM,  0);
+
+
+    #undef MODE_OP
+    #undef FIXED_OP
+
+    return table;
+}
+
+constexpr std::array<CPU::Instruction, 256> CPU::instruction_table = CPU::build_instruction_table();
+
+inline void CPU::execute_instruction(const DecodedInstruction& decoded){
+    (this->*decoded.handler)();
+    frame_cycles += decoded.cycles;
+}
+
+#if defined(VNES_THREADED_CORE)
+// Direct-threaded core (GCC labels-as-values). Every opcode gets its own
+// label, and each label ends by fetching the next opcode and jumping straight
+// to that opcode's label. Since the opcode is a constant at each label, the
+// table lookup folds away and the handler is called directly, and the jumps
+// are spread over 256 branch sites instead of one shared indirect call.
+// Used by run_until(), which handles the per-batch bookkeeping.
+// Returns the number of instructions executed.
+uint64_t CPU::run_threaded(bool trace){
+    uint64_t instructions_done = 0;
+    uint16_t opcode_pc = 0;
+
+    #define THREADED_LABEL(op) &&op_##op,
+    #define THREADED_LABEL_ROW(hi) \
+        THREADED_LABEL(hi##0) THREADED_LABEL(hi##1) THREADED_LABEL(hi##2) THREADED_LABEL(hi##3) \
+        THREADED_LABEL(hi##4) THREADED_LABEL(hi##5) THREADED_LABEL(hi##6) THREADED_LABEL(hi##7) \
+        THREADED_LABEL(hi##8) THREADED_LABEL(hi##9) THREADED_LABEL(hi##A) THREADED_LABEL(hi##B) \
+        THREADED_LABEL(hi##C) THREADED_LABEL(hi##D) THREADED_LABEL(hi##E) THREADED_LABEL(hi##F)
+
+    static void* const labels[256] = {
+        THREADED_LABEL_ROW(0) THREADED_LABEL_ROW(1) THREADED_LABEL_ROW(2) THREADED_LABEL_ROW(3)
+        THREADED_LABEL_ROW(4) THREADED_LABEL_ROW(5) THREADED_LABEL_ROW(6) THREADED_LABEL_ROW(7)
+        THREADED_LABEL_ROW(8) THREADED_LABEL_ROW(9) THREADED_LABEL_ROW(A) THREADED_LABEL_ROW(B)
+        THREADED_LABEL_ROW(C) THREADED_LABEL_ROW(D) THREADED_LABEL_ROW(E) THREADED_LABEL_ROW(F)
+    };
 
-        /* Increments & Decrements */
-        case INC_ZPG: 	    // Increment a memory location 	N,Z
-            INC(ZPG);
-            frame_cycles += 5;
-            break;
-        case INC_ABS: 	    
-            INC(ABS);
-            frame_cycles += 6;
-            break;
-        case INC_ZPGX: 	    
-            INC(ZPGX);
-            frame_cycles += 6;
-            break;
-        case INC_ABSX: 	    
-            INC(ABSX);
-            frame_cycles += 7;
-            break;
-        case INX_IMPL: 	    // Increment the X register 	N,Z
-            INX();
-            frame_cycles += 2;
-            break;
-        case INY_IMPL: 	    // Increment the Y register 	N,Z
-            INY();
-            frame_cycles += 2;
-            break;
-        case DEC_ZPG: 	    // Decrement a memory location 	N,Z
-            DEC(ZPG);
-            frame_cycles += 5;
-            break;
-        case DEC_ABS: 	    
-            DEC(ABS);
-            frame_cycles += 6;
-            break;
-        case DEC_ZPGX: 	    
-            DEC(ZPGX);
-            frame_cycles += 6;
-            break;
-        case DEC_ABSX: 	    
-            DEC(ABSX);
-            frame_cycles += 7;
-            break;
-        case DEX_IMPL: 	    // Decrement the X register 	N,Z
-            DEX();
-            frame_cycles += 2;
-            break;
-        case DEY_IMPL: 	    // Decrement the Y register 	N,Z
-            DEY();
-            frame_cycles += 2;
-            break;
+    #define THREADED_DISPATCH() \
+        if(frame_cycles >= slice_deadline){ goto done; } \
+        instructions_done++; \
+        opcode_pc = program_counter; \
+        goto *labels[fetch_instruction().opcode]
+
+    #define THREADED_OP(op) \
+        op_##op: { \
+            constexpr Instruction instruction = instruction_table[0x##op]; \
+            (this->*instruction.handler)(); \
+            frame_cycles += instruction.cycles; \
+            program_counter++; \
+            if(trace){ trace_instruction(0x##op); } \
+            if constexpr(instruction.mode == REL){ \
+                if(!trace && program_counter <= opcode_pc){ skip_idle_loop(instructions_done); } \
+            } \
+            THREADED_DISPATCH(); \
+        }
+    #define THREADED_OP_ROW(hi) \
+        THREADED_OP(hi##0) THREADED_OP(hi##1) THREADED_OP(hi##2) THREADED_OP(hi##3) \
+        THREADED_OP(hi##4) THREADED_OP(hi##5) THREADED_OP(hi##6) THREADED_OP(hi##7) \
+        THREADED_OP(hi##8) THREADED_OP(hi##9) THREADED_OP(hi##A) THREADED_OP(hi##B) \
+        THREADED_OP(hi##C) THREADED_OP(hi##D) THREADED_OP(hi##E) THREADED_OP(hi##F)
 
-        /* Shifts */
-        case ASL_ZPG: 	    // Arithmetic Shift Left 	N,Z,C
-            ASL(ZPG);
-            frame_cycles += 5;
-            break;
-        case ASL_ACC: 	    
-            ASL_eACC();
-            frame_cycles += 2;
-            break;
-        case ASL_ABS: 	    
-            ASL(ABS);
-            frame_cycles += 6;
-            break;
-        case ASL_ZPGX: 	    
-            ASL(ZPGX);
-            frame_cycles += 6;
-            break;
-        case ASL_ABSX: 	    
-            ASL(ABSX);
-            frame_cycles += 7;
-            break;
-        case LSR_ZPG: 	    // Logical Shift Right 	    N,Z,C
-            LSR(ZPG);
-            frame_cycles += 5;
-            break;
-        case LSR_ACC: 	    
-            LSR_eACC();
-            frame_cycles += 2;
-            break;
-        case LSR_ABS: 	    
-            LSR(ABS);
-            frame_cycles += 6;
-            break;
-        case LSR_ZPGX: 	    
-            LSR(ZPGX);
-            frame_cycles += 6;
-            break;
-        case LSR_ABSX: 	    
-            LSR(ABSX);
-            frame_cycles += 7;
-            break;
-        case ROL_ZPG: 	    // Rotate Left 	            N,Z,C
-            ROL(ZPG);
-            frame_cycles += 5;
-            break;
-        case ROL_ACC: 	    
-            ROL_eACC();
-            frame_cycles += 2;
-            break;
-        case ROL_ABS: 	    
-            ROL(ABS);
-            frame_cycles += 6;
-            break;
-        case ROL_ZPGX: 	    
-            ROL(ZPGX);
-            frame_cycles += 6;
-            break;
-        case ROL_ABSX: 	    
-            ROL(ABSX);
-            frame_cycles += 7;
-            break;
-        case ROR_ZPG: 	    // Rotate Right 	        N,Z,C
-            ROR(ZPG);
-            frame_cycles += 5;
-            break;
-        case ROR_ACC: 	    
-            ROR_eACC();
-            frame_cycles += 2;
-            break;
-        case ROR_ABS: 	    
-            frame_cycles += 6;
-            ROR(ABS);
-            break;
-        case ROR_ZPGX: 	    
-            ROR(ZPGX);
-            frame_cycles += 6;
-            break;
-        case ROR_ABSX: 	    
-            ROR(ABSX);
-            frame_cycles += 7;
-            break;
+    THREADED_DISPATCH();
 
-        /* Jumps & Calls */
-        case JMP_ABS: 	    // Jump to another location 	 
-            JMP(ABS);
-            frame_cycles += 3;
-            break;
-        case JMP_IND: 	     	 
-            JMP(IND);
-            frame_cycles += 5;
-            break;
-        case JSR_ABS: 	    // Jump to a subroutine 	 
-            JSR();
-            frame_cycles += 6;
-            break;
-        case RTS_IMPL: 	    // Return from subroutine 	 
-            RTS();
-            frame_cycles += 6;
-            break;
+    THREADED_OP_ROW(0) THREADED_OP_ROW(1) THREADED_OP_ROW(2) THREADED_OP_ROW(3)
+    THREADED_OP_ROW(4) THREADED_OP_ROW(5) THREADED_OP_ROW(6) THREADED_OP_ROW(7)
+    THREADED_OP_ROW(8) THREADED_OP_ROW(9) THREADED_OP_ROW(A) THREADED_OP_ROW(B)
+    THREADED_OP_ROW(C) THREADED_OP_ROW(D) THREADED_OP_ROW(E) THREADED_OP_ROW(F)
 
-        /* Branches */
-        case BCC_REL: 	    // Branch if carry flag clear 	 
-            BCC();
-            frame_cycles += 2;
-			break;
-        case BCS_REL: 	    // Branch if carry flag set 	 
-            BCS();
-            frame_cycles += 2;
-			break;
-        case BEQ_REL: 	    // Branch if zero flag set 	 
-            BEQ();
-            frame_cycles += 2;
-			break;
-        case BMI_REL: 	    // Branch if negative flag set 	 
-            BMI();
-            frame_cycles += 2;
-			break;
-        case BNE_REL: 	    // Branch if zero flag clear 	 
-            BNE();
-            frame_cycles += 2;
-			break;
-        case BPL_REL: 	    // Branch if negative flag clear 	 
-            BPL();
-            frame_cycles += 2;
-			break;
-        case BVC_REL: 	    // Branch if overflow flag clear 	 
-            BVC();
-            frame_cycles += 2;
-			break;
-        case BVS_REL: 	    // Branch if overflow flag set 	 
-            BVS();
-            frame_cycles += 2;
-			break;
-
-        /* Status Flag Changes */
-        case CLC_IMPL: 	    // Clear carry flag 	            C
-            CLC();
-            frame_cycles += 2;
-			break;
-        case CLD_IMPL: 	    // Clear decimal mode flag 	        D
-            CLD();
-            frame_cycles += 2;
-			break;
-        case CLI_IMPL: 	    // Clear interrupt disable flag 	I
-            CLI();
-            frame_cycles += 2;
-			break;
-        case CLV_IMPL: 	    // Clear overflow flag 	            V
-            CLV();
-            frame_cycles += 2;
-			break;
-        case SEC_IMPL: 	    // Set carry flag 	                C
-            SEC();
-            frame_cycles += 2;
-			break;
-        case SED_IMPL: 	    // Set decimal mode flag 	        D
-            SED();
-            frame_cycles += 2;
-			break;
-        case SEI_IMPL: 	    // Set interrupt disable flag 	    I
-            SEI();
-            frame_cycles += 2;
-			break;
-
-        /* System Functions */
-        case BRK_IMPL: 	    // Force an interrupt 	    B
-            BRK();
-            frame_cycles += 7;
-            break;
-        case NOP_IMPL: 	    // No Operation
-            NOP();
-            frame_cycles += 1;
-            break;
-        case RTI_IMPL:	    // Return from Interrupt 	All
-            RTI();
-            frame_cycles += 6;
-            break;
+done:
+    return instructions_done;
 
-        /* Unofficial/Illegal opcodes */
-        /* Illegal NOP's */
-        case NOP_IMM_ILL0:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMM_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMM_ILL2:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMM_ILL3:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMM_ILL4:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPG_ILL0:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPG_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPG_ILL2:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPGX_ILL0:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPGX_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPGX_ILL2:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPGX_ILL3:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPGX_ILL4:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ZPGX_ILL5:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMPL_ILL0:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMPL_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMPL_ILL2:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMPL_ILL3:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMPL_ILL4:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_IMPL_ILL5:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABS_ILL :
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABSX_ILL0:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABSX_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABSX_ILL2:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABSX_ILL3:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABSX_ILL4:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case NOP_ABSX_ILL5:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* JAM instructions cause the CPU to loop/halt indefinitely */
-        case JAM_IMPL_ILL0:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL2:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL3:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL4:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL5:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL6:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL7:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL8:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL9:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL10:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case JAM_IMPL_ILL11:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        // TODO: compile remaining illegal opcodes 
-        /* SLO = ASL combined with ORA */
-        case SLO_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SLO_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SLO_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SLO_ZPGX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SLO_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SLO_ABS_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SLO_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* RLA = AND combined with ROL */
-		case RLA_INDX_ILL:
-        	VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-		case RLA_INDY_ILL:
-        	VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-		case RLA_ZPG_ILL:
-        	VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-		case RLA_ZPGX_ILL:
-        	VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-		case RLA_ABSY_ILL:
-        	VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-		case RLA_ABS_ILL:
-        	VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-		case RLA_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* SRE = LSR combined with EOR */
-        case SRE_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SRE_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SRE_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SRE_ZPGX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SRE_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SRE_ABS_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SRE_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* RRA = ROR combined with ADC */
-        case RRA_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case RRA_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case RRA_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case RRA_ZPGX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case RRA_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case RRA_ABS_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case RRA_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* SAX */
-        case SAX_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SAX_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SAX_ZPGY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SAX_ABS_ILL:
-
-            /* LAX = LDA combined with LDX */
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAX_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAX_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAX_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAX_ZPGY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAX_ABS_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAX_ABSY_ILL:
-
-            /* DCP = LDA combined with TSX */
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_ZPGX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_ABS_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case DCP_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* ISC = INC combined with SBC */
-        case ISC_INDX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ISC_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ISC_ZPG_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ISC_ZPGX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ISC_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ISC_ABS_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ISC_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        /* ANC = AND combined with set C */
-        case ANC_IMM_ILL0:
-            //VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-            VNES_LOG::LOG(VNES_LOG::WARN, "Executing illegal opcode that happens to have implementation.");
-            ANC_ILL();
-            frame_cycles += 2;
-			break;
-        case ANC_IMM_ILL1:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-
-        // misc
-        case ALR_IMM_ILL:    // ALR = AND combined with LSR
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ARR_IMM_ILL:    // ARR = AND combined with ROR
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case ANE_IMM_ILL:    // ANE = ANDX combined with AND
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SHA_INDY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SHA_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SHY_ABSX_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SHX_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case TAS_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LXA_IMM_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case LAS_ABSY_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case SBX_IMM_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-			break;
-        case USBC_IMM_ILL:
-            VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
-            break;
-        default:
-            VNES_LOG::LOG(VNES_LOG::FATAL, "Got unreachable instruction! How is this possible??? Bad instruction was %s\n", instruction);
-            break;
-    }
-    //VNES_LOG::LOG(VNES_LOG::ERROR, "Cycle counting not implemented yet! Returning 1 cycle passed");
-    return 0;
-} // execute_instruction
+    #undef THREADED_LABEL
+    #undef THREADED_LABEL_ROW
+    #undef THREADED_DISPATCH
+    #undef THREADED_OP
+    #undef THREADED_OP_ROW
+}
+#endif
 
 
-void CPU::LDA(enum ADDRESSING_MODE mode){
-    accumulator = read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::LDA(){
+    accumulator = fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(accumulator);
 }
 
-void CPU::LDX(enum ADDRESSING_MODE mode){
-    index_X = read_mem(fetch_address(mode, AddrModeVec{ABSY}));
-    zero_f      = (index_X == 0);
-    negative_f  = (index_X & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::LDX(){
+    index_X = fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(index_X);
 }
 
-void CPU::LDY(enum ADDRESSING_MODE mode){
-    index_Y = read_mem(fetch_address(mode, AddrModeVec{ABSX}));
-    zero_f      = (index_Y == 0);
-    negative_f  = (index_Y & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::LDY(){
+    index_Y = fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(index_Y);
 }
 
-void CPU::STA(enum ADDRESSING_MODE mode){
-    write_mem(fetch_address(mode), accumulator);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::STA(){
+    write_mem(fetch_address<mode, IGNORE_PAGE_CROSS>(), accumulator);
 }
 
-void CPU::STX(enum ADDRESSING_MODE mode){
-    write_mem(fetch_address(mode), index_X);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::STX(){
+    write_mem(fetch_address<mode, IGNORE_PAGE_CROSS>(), index_X);
 }
 
-void CPU::STY(enum ADDRESSING_MODE mode){
-    write_mem(fetch_address(mode), index_Y);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::STY(){
+    write_mem(fetch_address<mode, IGNORE_PAGE_CROSS>(), index_Y);
 }
 
 
 /* Register Transfers */
 void CPU::TAX(){
     index_X = accumulator;
-    zero_f      = (index_X == 0);
-    negative_f  = (index_X & 0b10000000);
+    set_nz(index_X);
 }
 
 void CPU::TAY(){
     index_Y = accumulator;
-    zero_f      = (index_Y == 0);
-    negative_f  = (index_Y & 0b10000000);
+    set_nz(index_Y);
 }
 
 void CPU::TXA(){
     accumulator = index_X;
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+    set_nz(accumulator);
 }
 
 void CPU::TYA(){
     accumulator = index_Y;
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+    set_nz(accumulator);
 }
 
 
 /* Stack Operations */
 void CPU::TSX(){
     index_X = stack_pointer;
-    zero_f      = (index_X == 0);
-    negative_f  = (index_X & 0b10000000);
+    set_nz(index_X);
 }
 
 void CPU::TXS(){
@@ -1400,57 +1194,59 @@ void CPU::PHP(){
 void CPU::PLA(){
     VNES_LOG::LOG(VNES_LOG::Severity::WARN, "Am I implemented correctly? What does 'pull accumulator from stack' mean?");
     accumulator = pop_stack();
-    zero_f = (accumulator == 0);
-    negative_f = (accumulator & 0b10000000);
+    set_nz(accumulator);
 }
 
 void CPU::PLP(){
     VNES_LOG::LOG(VNES_LOG::Severity::WARN, "Am I implemented correctly? What does 'pull processor status from stack' mean?");
     set_status_reg(pop_stack() & 0b11101111); // ignore B flag
+    if(scheduler.irq_asserted() && !interrupt_disable_f){ end_slice(); }
 }
 
 
 /* Logical */
-void CPU::AND(enum ADDRESSING_MODE mode){
-    accumulator = accumulator & read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::AND(){
+    accumulator = accumulator & fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(accumulator);
 }
 
-void CPU::EOR(enum ADDRESSING_MODE mode){
-    accumulator = accumulator ^ read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::EOR(){
+    accumulator = accumulator ^ fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(accumulator);
 }
 
-void CPU::ORA(enum ADDRESSING_MODE mode){
-    accumulator = accumulator | read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::ORA(){
+    accumulator = accumulator | fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(accumulator);
 }
 
-void CPU::BIT(enum ADDRESSING_MODE mode){
-    uint8_t val = read_mem(fetch_address(mode));
+template<CPU::ADDRESSING_MODE mode>
+void CPU::BIT(){
+    uint8_t val = fetch_operand<mode, IGNORE_PAGE_CROSS>();
     uint8_t result = accumulator & val;
-    zero_f      = (result == 0);
-    negative_f  = (val & 0b10000000);
+    // N comes from the operand rather than the result, so it can disagree with Z
+    nz_result   = result | ((val & 0b10000000) << 1);
     overflow_f  = (val & 0b01000000);
 }
 
 
 /* Arithmetic */
-void CPU::ADC(enum ADDRESSING_MODE mode){
-    uint8_t data = read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
+template<CPU::ADDRESSING_MODE mode>
+void CPU::ADC(){
+    uint8_t data = fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
     uint16_t result = (uint16_t)data + accumulator + carry_f;
     carry_f     = (result > 0b11111111); 
     overflow_f  = (accumulator ^ result) & (data ^ result) & 0b10000000; // if bit 7 changed from both accumulator and data
-    negative_f  = (result & 0b10000000);
-    zero_f      = ((uint8_t)result == 0);
+    set_nz(result);
     accumulator = (uint8_t)result;
 }
 
-void CPU::SBC(enum ADDRESSING_MODE mode){
-    uint8_t data = read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
+template<CPU::ADDRESSING_MODE mode>
+void CPU::SBC(){
+    uint8_t data = fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
 
     // since we are in sign 2's complement, we can do exactly ADC
     // with the complement of data
@@ -1459,114 +1255,108 @@ void CPU::SBC(enum ADDRESSING_MODE mode){
     uint16_t result = (uint16_t)data + accumulator + carry_f;
     carry_f     = (result > 0b11111111); 
     overflow_f  = (accumulator ^ result) & (data ^ result) & 0b10000000; // if bit 7 changed from both accumulator and data
-    negative_f  = (result & 0b10000000);
-    zero_f      = ((uint8_t)result == 0);
+    set_nz(result);
     accumulator = (uint8_t)result;
 }
 
-void CPU::CMP(enum ADDRESSING_MODE mode){
-    uint8_t data = read_mem(fetch_address(mode, AddrModeVec{ABSX, ABSY, INDY}));
-    zero_f      = (accumulator == data);
-    negative_f  = ((accumulator - data) & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::CMP(){
+    uint8_t data = fetch_operand<mode, ADD_CYCLE_ON_PAGE_CROSS>();
+    set_nz(accumulator - data);
     carry_f     = (accumulator >= data);
 }
 
-void CPU::CPX(enum ADDRESSING_MODE mode){
-    uint8_t data = read_mem(fetch_address(mode));
-    zero_f      = (index_X == data);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::CPX(){
+    uint8_t data = fetch_operand<mode, IGNORE_PAGE_CROSS>();
     carry_f     = (index_X >= data);
-    negative_f  = ((index_X - data) & 0b10000000);
+    set_nz(index_X - data);
 }
 
-void CPU::CPY(enum ADDRESSING_MODE mode){
-    uint8_t data = read_mem(fetch_address(mode));
-    zero_f      = (index_Y == data);
-    negative_f  = ((index_Y - data) & 0b10000000);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::CPY(){
+    uint8_t data = fetch_operand<mode, IGNORE_PAGE_CROSS>();
+    set_nz(index_Y - data);
     carry_f     = (index_Y >= data);
 }
 
 
 /* Increments & Decrements */
-void CPU::INC(enum ADDRESSING_MODE mode){
-    uint16_t addr = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::INC(){
+    uint16_t addr = fetch_address<mode, IGNORE_PAGE_CROSS>();
     uint8_t data = read_mem(addr);
     data++;
-    negative_f  = (data & 0b10000000);
-    zero_f      = (data == 0);
+    set_nz(data);
     write_mem(addr, data);
 }
 
 void CPU::INX(){
     index_X++;
-    negative_f  = (index_X & 0b10000000);
-    zero_f      = (index_X == 0);
+    set_nz(index_X);
 }
 
 void CPU::INY(){
     index_Y++;
-    negative_f  = (index_Y & 0b10000000);
-    zero_f      = (index_Y == 0);
+    set_nz(index_Y);
 }
 
-void CPU::DEC(enum ADDRESSING_MODE mode){
-    uint16_t addr = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::DEC(){
+    uint16_t addr = fetch_address<mode, IGNORE_PAGE_CROSS>();
     int8_t data = read_mem(addr); // cast to signed
     data--;
-    negative_f  = (data & 0b10000000);
-    zero_f      = (data == 0);
+    set_nz(data);
     write_mem(addr, data);
 }
 
 void CPU::DEX(){
     index_X--;
-    negative_f  = (index_X & 0b10000000);
-    zero_f      = (index_X == 0);
+    set_nz(index_X);
 }
 
 void CPU::DEY(){
     index_Y--;
-    negative_f  = (index_Y & 0b10000000);
-    zero_f      = (index_Y == 0);
+    set_nz(index_Y);
 }
 
 
 /* Shifts */
-void CPU::ASL(enum ADDRESSING_MODE mode){
-    uint16_t addr = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::ASL(){
+    uint16_t addr = fetch_address<mode, IGNORE_PAGE_CROSS>();
     uint8_t data = read_mem(addr);;
     carry_f     = (data & 0b10000000); // the top bit is shifted into carry_f
     data = data << 1;
-    negative_f  = (data & 0b10000000);
-    zero_f      = (data == 0);
+    set_nz(data);
     write_mem(addr, data);
 }
 
 void CPU::ASL_eACC(){
     carry_f     = (accumulator & 0b10000000); // the top bit is shifted into carry_f
     accumulator = accumulator << 1;
-    negative_f  = (accumulator & 0b10000000);
-    zero_f      = (accumulator == 0);
+    set_nz(accumulator);
 }
 
-void CPU::LSR(enum ADDRESSING_MODE mode){
-    uint16_t addr = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::LSR(){
+    uint16_t addr = fetch_address<mode, IGNORE_PAGE_CROSS>();
     uint8_t data = read_mem(addr);;
     carry_f     = (data & 0b00000001); // lowest bit shifts into carry_f
-    negative_f  = 0; // result is always positive (bit 7 always 0)
     data = data >> 1; 
-    zero_f      = (data == 0);
+    set_nz(data); // result is always positive (bit 7 always 0)
     write_mem(addr, data);
 }
 
 void CPU::LSR_eACC(){
     carry_f     = (accumulator & 0b00000001); // lowest bit shifts into carry_f
-    negative_f  = 0; // result is always positive (bit 7 always 0)
     accumulator = accumulator >> 1; 
-    zero_f      = (accumulator == 0);
+    set_nz(accumulator); // result is always positive (bit 7 always 0)
 }
 
-void CPU::ROL(enum ADDRESSING_MODE mode){
-    uint16_t addr = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::ROL(){
+    uint16_t addr = fetch_address<mode, IGNORE_PAGE_CROSS>();
     uint8_t data = read_mem(addr);
 
     bit new_bit0    = carry_f;
@@ -1574,8 +1364,7 @@ void CPU::ROL(enum ADDRESSING_MODE mode){
     data            = data << 1;
     data            |= new_bit0;
 
-    negative_f  = (data & 0b10000000);
-    zero_f      = (data == 0);
+    set_nz(data);
     write_mem(addr, data);
 }
 
@@ -1585,20 +1374,19 @@ void CPU::ROL_eACC(){
     accumulator     = accumulator << 1;
     accumulator     |= new_bit0;
 
-    negative_f  = (accumulator & 0b10000000);
-    zero_f      = (accumulator == 0);
+    set_nz(accumulator);
 }
 
-void CPU::ROR(enum ADDRESSING_MODE mode){
-    uint16_t addr = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::ROR(){
+    uint16_t addr = fetch_address<mode, IGNORE_PAGE_CROSS>();
     uint8_t data = read_mem(addr);
 
     bit new_carry_f = (data & 0b00000001);
     data = data >> 1;
 
     if(carry_f) data |= 0b10000000;
-    negative_f  = carry_f;
-    zero_f      = (data == 0);
+    set_nz(data);
     carry_f     = new_carry_f;
 
     write_mem(addr, data);
@@ -1609,15 +1397,15 @@ void CPU::ROR_eACC(){
     accumulator = accumulator >> 1;
 
     if(carry_f) accumulator |= 0b10000000;
-    negative_f  = carry_f;
-    zero_f      = (accumulator == 0);
+    set_nz(accumulator);
     carry_f     = new_carry_f;
 }
 
 
 /* Jumps & Calls */
-void CPU::JMP(enum ADDRESSING_MODE mode){
-    program_counter = fetch_address(mode);
+template<CPU::ADDRESSING_MODE mode>
+void CPU::JMP(){
+    program_counter = fetch_address<mode, IGNORE_PAGE_CROSS>();
     program_counter--; // must bring PC back 1 byte to move from 1 to 0-indexing
 }
 
@@ -1625,6 +1413,8 @@ void CPU::JSR(){
     push_stack((program_counter + 2) >> 8);
     push_stack(program_counter + 2);
 
+    // read after the pushes (not from the operand latch) since the pushes
+    // can land on the operand bytes when running from RAM
     uint8_t PCL = read_mem(++program_counter);
     uint8_t PCH = read_mem(++program_counter);
     program_counter = ((uint16_t)PCH << 8 | PCL);
@@ -1642,9 +1432,9 @@ void CPU::RTS(){
 void CPU::branch(bit condition){
     if(condition){
         VNES_LOG::LOG(VNES_LOG::DEBUG, "branch(): took branch");
-        int8_t rel_addr = fetch_address(REL);
+        int8_t rel_addr = fetch_address<REL, IGNORE_PAGE_CROSS>(); // page crossing checked below
         frame_cycles++; // add cycle if branch taken
-        add_cycle_if_page_crossed(program_counter - 1, rel_addr, REL, AddrModeVec{REL}); // add cycle if branch crosses page
+        add_cycle_if_page_crossed(program_counter - 1, rel_addr); // add cycle if branch crosses page
         program_counter += rel_addr;
     }else{
         VNES_LOG::LOG(VNES_LOG::DEBUG, "branch(): did NOT take branch");
@@ -1661,19 +1451,19 @@ void CPU::BCS(){
 }
 
 void CPU::BEQ(){
-    branch(zero_f);
+    branch(zero_f());
 }
 
 void CPU::BMI(){
-    branch(negative_f);
+    branch(negative_f());
 }
 
 void CPU::BNE(){
-    branch(!zero_f);
+    branch(!zero_f());
 }
 
 void CPU::BPL(){
-    branch(!negative_f);
+    branch(!negative_f());
 }
 
 void CPU::BVC(){
@@ -1696,6 +1486,7 @@ void CPU::CLD(){
 
 void CPU::CLI(){
     interrupt_disable_f = 0;
+    if(scheduler.irq_asserted()){ end_slice(); }
 }
 
 void CPU::CLV(){
@@ -1732,6 +1523,7 @@ void CPU::RTI(){
     uint8_t PCH = pop_stack();
     program_counter = ((uint16_t)PCH << 8) | PCL;
     program_counter--;
+    if(scheduler.irq_asserted() && !interrupt_disable_f){ end_slice(); }
 }
 
 
@@ -1777,9 +1569,9 @@ void CPU::ISC_ILL(){
 }
 
 void CPU::ANC_ILL(){
-    accumulator = accumulator & read_mem(fetch_address(IMM, AddrModeVec{ABSX, ABSY, INDY}));
-    zero_f      = (accumulator == 0);
-    negative_f  = (accumulator & 0b10000000);
+    VNES_LOG::LOG(VNES_LOG::WARN, "Executing illegal opcode that happens to have implementation.");
+    accumulator = accumulator & fetch_operand<IMM, IGNORE_PAGE_CROSS>();
+    set_nz(accumulator);
     carry_f     = (accumulator & 0b10000000);
 }
 
@@ -1827,3 +1619,10 @@ void CPU::USBC_ILL(){
 	VNES_ASSERT(0 && "UNIMPLEMENTED ILLEGAL INSTRUCTION");
 }
 
+void CPU::UNIMPLEMENTED_ILL(){
+    VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to execute unimplemented illegal opcode. Continuing with no effect.");
+}
+
+#if defined(VNES_JIT)
+#include "JIT.cpp"
+#endif
@@ -1,9 +1,23 @@
 #pragma once
 
 #include "include/DMABus.hpp"
+#include <string.h>
 
 DMABus::DMABus(RAM& _ram): ram {_ram} { }
 
 uint8_t DMABus::read(uint16_t addr){
     return ram.read(addr);
 }
+
+// Pages of plain memory (internal RAM, PRG-RAM, PRG-ROM) are copied in one
+// go, anything else is read byte by byte so registers see every access
+void DMABus::read_page(uint8_t page, uint8_t* dest){
+    const uint8_t* src = ram.read_page(page);
+    if(src){
+        memcpy(dest, src, 0x100);
+        return;
+    }
+    for(int i = 0; i <= 0xFF; i++){
+        dest[i] = ram.read((page << 8) | i);
+    }
+}
@@ -0,0 +1,497 @@
+#pragma once
+
+#include "include/JIT.hpp"
+#include "../common/log.hpp"
+#include <sys/mman.h>
+#include <string.h>
+#include <algorithm>
+
+JIT::JIT(RAM& _ram): ram {_ram}, code_used {0}, generation {_ram.prg_generation()} {
+    VNES_LOG::LOG(VNES_LOG::INFO, "Constructing JIT...");
+    void* buffer = mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffer == MAP_FAILED){
+        VNES_LOG::LOG(VNES_LOG::WARN, "JIT could not map executable memory, all code will be interpreted");
+        code_buffer = nullptr;
+    }else{
+        code_buffer = static_cast<uint8_t*>(buffer);
+    }
+
+    state = State{};
+    state.ram = ram.internal_ram();
+    flush();
+}
+
+JIT::~JIT(){
+    if(code_buffer){ munmap(code_buffer, CODE_BUFFER_SIZE); }
+}
+
+void JIT::flush(){
+    VNES_LOG::LOG(VNES_LOG::DEBUG, "JIT: flushing %d blocks", (int)blocks.size());
+    blocks.clear();
+    code_used = 0;
+    std::fill(std::begin(block_index), std::end(block_index), NOT_COMPILED);
+    std::fill(std::begin(heat), std::end(heat), 0);
+}
+
+JIT::Block* JIT::lookup(uint16_t pc){
+    if(!code_buffer || pc < 0x8000){ return nullptr; }
+
+    uint32_t current_generation = ram.prg_generation();
+    if(current_generation != generation){
+        flush();
+        generation = current_generation;
+    }
+
+    int32_t& index = block_index[pc - 0x8000];
+    if(index >= 0){ return &blocks[index]; }
+    if(index == UNCOMPILABLE){ return nullptr; }
+    if(++heat[pc - 0x8000] < HOT_THRESHOLD){ return nullptr; }
+
+    if(code_used + MAX_BLOCK_CODE_SIZE > CODE_BUFFER_SIZE){
+        flush(); // out of space, start over
+    }
+
+    Block block;
+    if(!compile(pc, block)){
+        index = UNCOMPILABLE;
+        return nullptr;
+    }
+    index = blocks.size();
+    blocks.push_back(block);
+    return &blocks[index];
+}
+
+bool JIT::compile(uint16_t start_pc, Block& block){
+    code.clear();
+    // every block starts by loading the internal RAM base into rsi
+    emit({0x48, 0x8B, modrm(1, RSI, RDI), (uint8_t)offsetof(State, ram)}); // mov rsi, [rdi+ram]
+
+    uint32_t pc = start_pc; // wider than 16 bits so running off the end of ROM is caught
+    uint32_t cycles = 0;
+    uint32_t cycles_before_exit = 0;
+    int instructions = 0;
+    bool terminated = false;
+
+    while(instructions < MAX_BLOCK_INSTRUCTIONS){
+        uint8_t opcode = ram.read(pc);
+        Decoded decoded = decode(opcode);
+        uint8_t bytes = CPU::instruction_table[opcode].bytes;
+        if(decoded.op == UNSUPPORTED || pc + bytes - 1 > 0xFFFF){ break; }
+
+        Operand operand {decoded.mode, 0};
+        if(bytes >= 2){ operand.value = ram.read(pc + 1); }
+        if(bytes == 3){ operand.value |= (uint16_t)ram.read(pc + 2) << 8; }
+        if(decoded.op != JMP && decoded.mode == ABS && operand.value >= 0x2000){
+            break; // not internal RAM, leave it to the interpreter
+        }
+
+        uint8_t instruction_cycles = CPU::instruction_table[opcode].cycles;
+        cycles_before_exit = cycles;
+        instructions++;
+
+        if(decoded.mode == REL){
+            // same cycle rules as CPU::branch(), including its page check
+            uint16_t operand_pc = pc + 1;
+            uint16_t offset = (int8_t)operand.value;
+            uint16_t fallthrough_pc = pc + 2;
+            uint16_t target_pc = operand_pc + offset + 1;
+            uint32_t taken_cycles = cycles + instruction_cycles + 1;
+            if((pc & 0xF0) != ((uint16_t)(pc + offset) & 0xF0)){ taken_cycles++; }
+            emit_branch(decoded.op, fallthrough_pc, cycles + instruction_cycles, target_pc, taken_cycles);
+            terminated = true;
+            break;
+        }
+        if(decoded.op == JMP){
+            emit_exit(operand.value, cycles + instruction_cycles);
+            terminated = true;
+            break;
+        }
+
+        emit_instruction(decoded.op, operand);
+        cycles += instruction_cycles;
+        pc += bytes;
+    }
+
+    if(!instructions){ return false; }
+    if(!terminated){
+        emit_exit(pc, cycles);
+    }
+
+    VNES_ASSERT(code.size() <= MAX_BLOCK_CODE_SIZE && "JIT block overflowed its code size estimate");
+    memcpy(code_buffer + code_used, code.data(), code.size());
+    block.code = reinterpret_cast<BlockCode>(code_buffer + code_used);
+    block.cycles_before_exit = cycles_before_exit;
+    block.instructions = instructions;
+    code_used += (code.size() + 15) & ~(size_t)15; // keep blocks 16 byte aligned
+
+    VNES_LOG::LOG(VNES_LOG::DEBUG, "JIT: compiled block at 0x%x, %d instructions, %d bytes", start_pc, instructions, (int)code.size());
+    return true;
+}
+
+JIT::Decoded JIT::decode(uint8_t opcode){
+    switch(opcode){
+        case CPU::LDA_IMM:  return {LDA, IMM};
+        case CPU::LDA_ZPG:  return {LDA, ZPG};
+        case CPU::LDA_ZPGX: return {LDA, ZPGX};
+        case CPU::LDA_ABS:  return {LDA, ABS};
+        case CPU::LDX_IMM:  return {LDX, IMM};
+        case CPU::LDX_ZPG:  return {LDX, ZPG};
+        case CPU::LDX_ZPGY: return {LDX, ZPGY};
+        case CPU::LDX_ABS:  return {LDX, ABS};
+        case CPU::LDY_IMM:  return {LDY, IMM};
+        case CPU::LDY_ZPG:  return {LDY, ZPG};
+        case CPU::LDY_ZPGX: return {LDY, ZPGX};
+        case CPU::LDY_ABS:  return {LDY, ABS};
+        case CPU::STA_ZPG:  return {STA, ZPG};
+        case CPU::STA_ZPGX: return {STA, ZPGX};
+        case CPU::STA_ABS:  return {STA, ABS};
+        case CPU::STX_ZPG:  return {STX, ZPG};
+        case CPU::STX_ZPGY: return {STX, ZPGY};
+        case CPU::STX_ABS:  return {STX, ABS};
+        case CPU::STY_ZPG:  return {STY, ZPG};
+        case CPU::STY_ZPGX: return {STY, ZPGX};
+        case CPU::STY_ABS:  return {STY, ABS};
+
+        case CPU::AND_IMM:  return {AND, IMM};
+        case CPU::AND_ZPG:  return {AND, ZPG};
+        case CPU::AND_ZPGX: return {AND, ZPGX};
+        case CPU::AND_ABS:  return {AND, ABS};
+        case CPU::ORA_IMM:  return {ORA, IMM};
+        case CPU::ORA_ZPG:  return {ORA, ZPG};
+        case CPU::ORA_ZPGX: return {ORA, ZPGX};
+        case CPU::ORA_ABS:  return {ORA, ABS};
+        case CPU::EOR_IMM:  return {EOR, IMM};
+        case CPU::EOR_ZPG:  return {EOR, ZPG};
+        case CPU::EOR_ZPGX: return {EOR, ZPGX};
+        case CPU::EOR_ABS:  return {EOR, ABS};
+        case CPU::ADC_IMM:  return {ADC, IMM};
+        case CPU::ADC_ZPG:  return {ADC, ZPG};
+        case CPU::ADC_ZPGX: return {ADC, ZPGX};
+        case CPU::ADC_ABS:  return {ADC, ABS};
+        case CPU::SBC_IMM:  return {SBC, IMM};
+        case CPU::SBC_ZPG:  return {SBC, ZPG};
+        case CPU::SBC_ZPGX: return {SBC, ZPGX};
+        case CPU::SBC_ABS:  return {SBC, ABS};
+        case CPU::CMP_IMM:  return {CMP, IMM};
+        case CPU::CMP_ZPG:  return {CMP, ZPG};
+        case CPU::CMP_ZPGX: return {CMP, ZPGX};
+        case CPU::CMP_ABS:  return {CMP, ABS};
+        case CPU::CPX_IMM:  return {CPX, IMM};
+        case CPU::CPX_ZPG:  return {CPX, ZPG};
+        case CPU::CPX_ABS:  return {CPX, ABS};
+        case CPU::CPY_IMM:  return {CPY, IMM};
+        case CPU::CPY_ZPG:  return {CPY, ZPG};
+        case CPU::CPY_ABS:  return {CPY, ABS};
+
+        case CPU::INC_ZPG:  return {INC, ZPG};
+        case CPU::INC_ZPGX: return {INC, ZPGX};
+        case CPU::INC_ABS:  return {INC, ABS};
+        case CPU::DEC_ZPG:  return {DEC, ZPG};
+        case CPU::DEC_ZPGX: return {DEC, ZPGX};
+        case CPU::DEC_ABS:  return {DEC, ABS};
+        case CPU::ASL_ACC:  return {ASL, ACC};
+        case CPU::ASL_ZPG:  return {ASL, ZPG};
+        case CPU::ASL_ZPGX: return {ASL, ZPGX};
+        case CPU::ASL_ABS:  return {ASL, ABS};
+        case CPU::LSR_ACC:  return {LSR, ACC};
+        case CPU::LSR_ZPG:  return {LSR, ZPG};
+        case CPU::LSR_ZPGX: return {LSR, ZPGX};
+        case CPU::LSR_ABS:  return {LSR, ABS};
+        case CPU::ROL_ACC:  return {ROL, ACC};
+        case CPU::ROL_ZPG:  return {ROL, ZPG};
+        case CPU::ROL_ZPGX: return {ROL, ZPGX};
+        case CPU::ROL_ABS:  return {ROL, ABS};
+        case CPU::ROR_ACC:  return {ROR, ACC};
+        case CPU::ROR_ZPG:  return {ROR, ZPG};
+        case CPU::ROR_ZPGX: return {ROR, ZPGX};
+        case CPU::ROR_ABS:  return {ROR, ABS};
+
+        case CPU::INX_IMPL: return {INX, NONE};
+        case CPU::INY_IMPL: return {INY, NONE};
+        case CPU::DEX_IMPL: return {DEX, NONE};
+        case CPU::DEY_IMPL: return {DEY, NONE};
+        case CPU::TAX_IMPL: return {TAX, NONE};
+        case CPU::TAY_IMPL: return {TAY, NONE};
+        case CPU::TXA_IMPL: return {TXA, NONE};
+        case CPU::TYA_IMPL: return {TYA, NONE};
+        case CPU::CLC_IMPL: return {CLC, NONE};
+        case CPU::SEC_IMPL: return {SEC, NONE};
+        case CPU::CLV_IMPL: return {CLV, NONE};
+        case CPU::CLD_IMPL: return {CLD, NONE};
+        case CPU::SED_IMPL: return {SED, NONE};
+        case CPU::SEI_IMPL: return {SEI, NONE};
+        case CPU::NOP_IMPL: return {NOP, NONE};
+
+        case CPU::BCC_REL:  return {BCC, REL};
+        case CPU::BCS_REL:  return {BCS, REL};
+        case CPU::BEQ_REL:  return {BEQ, REL};
+        case CPU::BNE_REL:  return {BNE, REL};
+        case CPU::BMI_REL:  return {BMI, REL};
+        case CPU::BPL_REL:  return {BPL, REL};
+        case CPU::BVC_REL:  return {BVC, REL};
+        case CPU::BVS_REL:  return {BVS, REL};
+        case CPU::JMP_ABS:  return {JMP, ABS};
+
+        // CLI is left to the interpreter, it has to end the slice when it
+        // lets an asserted IRQ in, see CPU::CLI()
+        default:            return {UNSUPPORTED, NONE};
+    }
+}
+
+/*
+ * Register use in generated code:
+ *     rdi: State*, rsi: internal RAM base
+ *     eax, ecx: scratch, 8-bit values are kept zero-extended
+ *     edx: scratch, or the RAM index of an indexed operand
+ * Guest registers live in State between instructions.
+ */
+void JIT::emit_instruction(Op op, Operand operand){
+    constexpr size_t A = offsetof(State, accumulator);
+    constexpr size_t X = offsetof(State, index_X);
+    constexpr size_t Y = offsetof(State, index_Y);
+    constexpr size_t C = offsetof(State, carry_f);
+    constexpr size_t V = offsetof(State, overflow_f);
+
+    switch(op){
+        /* Load/Store */
+        case LDA:
+        case LDX:
+        case LDY:
+            load_operand(ECX, operand);
+            store_field(ECX, op == LDA ? A : op == LDX ? X : Y);
+            store_nz(ECX);
+            break;
+        case STA:
+        case STX:
+        case STY:
+            address_to_edx(operand);
+            load_field(EAX, op == STA ? A : op == STX ? X : Y);
+            store_operand(EAX, operand);
+            break;
+
+        /* Logical & Arithmetic */
+        case AND:
+        case ORA:
+        case EOR:
+            load_operand(ECX, operand);
+            load_field(EAX, A);
+            emit({(uint8_t)(op == AND ? 0x21 : op == ORA ? 0x09 : 0x31), modrm(3, ECX, EAX)}); // and/or/xor eax, ecx
+            store_field(EAX, A);
+            store_nz(EAX);
+            break;
+        case ADC:
+        case SBC:
+            load_operand(ECX, operand);
+            if(op == SBC){ emit({0x80, modrm(3, 6, ECX), 0xFF}); } // xor cl, 0xFF, then it is an ADC
+            load_field(EAX, A);
+            load_field(EDX, C);
+            emit({0x01, modrm(3, EAX, EDX)}); // add edx, eax
+            emit({0x01, modrm(3, ECX, EDX)}); // add edx, ecx
+            // overflow if bit 7 changed from both accumulator and data
+            emit({0x31, modrm(3, EDX, EAX)}); // xor eax, edx
+            emit({0x31, modrm(3, EDX, ECX)}); // xor ecx, edx
+            emit({0x21, modrm(3, ECX, EAX)}); // and eax, ecx
+            emit({0xC1, modrm(3, 5, EAX), 7}); // shr eax, 7
+            emit({0x83, modrm(3, 4, EAX), 1}); // and eax, 1
+            store_field(EAX, V);
+            store_field(EDX, A);
+            zero_extend(EAX, EDX);
+            store_nz(EAX);
+            emit({0xC1, modrm(3, 5, EDX), 8}); // shr edx, 8
+            store_field(EDX, C);
+            break;
+        case CMP:
+        case CPX:
+        case CPY:
+            load_operand(ECX, operand);
+            load_field(EAX, op == CMP ? A : op == CPX ? X : Y);
+            emit({0x39, modrm(3, ECX, EAX)}); // cmp eax, ecx
+            emit({0x0F, 0x93, modrm(3, 0, EDX)}); // setae dl
+            store_field(EDX, C);
+            emit({0x29, modrm(3, ECX, EAX)}); // sub eax, ecx
+            zero_extend(EAX, EAX);
+            store_nz(EAX);
+            break;
+
+        /* Increments & Decrements */
+        case INC:
+        case DEC:
+            load_operand(ECX, operand);
+            emit({0xFE, modrm(3, op == INC ? 0 : 1, ECX)}); // inc/dec cl
+            store_operand(ECX, operand);
+            zero_extend(ECX, ECX);
+            store_nz(ECX);
+            break;
+        case INX:
+        case INY:
+        case DEX:
+        case DEY:
+            load_field(EAX, (op == INX || op == DEX) ? X : Y);
+            emit({0xFE, modrm(3, (op == INX || op == INY) ? 0 : 1, EAX)}); // inc/dec al
+            store_field(EAX, (op == INX || op == DEX) ? X : Y);
+            zero_extend(EAX, EAX);
+            store_nz(EAX);
+            break;
+
+        /* Shifts, on eax with ecx holding the old carry */
+        case ASL:
+        case LSR:
+        case ROL:
+        case ROR:
+            if(operand.mode == ACC){ load_field(EAX, A); }else{ load_operand(EAX, operand); }
+            load_field(ECX, C);
+            store_field(EAX, C);
+            if(op == ASL || op == ROL){
+                emit({0xC0, modrm(1, 5, RDI), (uint8_t)C, 7}); // shr byte [C], 7
+                emit({0xD1, modrm(3, 4, EAX)}); // shl eax, 1
+            }else{
+                emit({0x80, modrm(1, 4, RDI), (uint8_t)C, 1}); // and byte [C], 1
+                emit({0xD1, modrm(3, 5, EAX)}); // shr eax, 1
+                emit({0xC1, modrm(3, 4, ECX), 7}); // shl ecx, 7
+            }
+            if(op == ROL || op == ROR){
+                emit({0x09, modrm(3, ECX, EAX)}); // or eax, ecx
+            }
+            zero_extend(EAX, EAX);
+            if(operand.mode == ACC){ store_field(EAX, A); }else{ store_operand(EAX, operand); }
+            store_nz(EAX);
+            break;
+
+        /* Register Transfers */
+        case TAX:
+        case TAY:
+        case TXA:
+        case TYA:
+            load_field(EAX, op == TXA ? X : op == TYA ? Y : A);
+            store_field(EAX, op == TAX ? X : op == TAY ? Y : A);
+            store_nz(EAX);
+            break;
+
+        /* Status Flag Changes */
+        case CLC: store_field_imm(C, 0); break;
+        case SEC: store_field_imm(C, 1); break;
+        case CLV: store_field_imm(V, 0); break;
+        case CLD: store_field_imm(offsetof(State, decimal_f), 0); break;
+        case SED: store_field_imm(offsetof(State, decimal_f), 1); break;
+        case SEI: store_field_imm(offsetof(State, interrupt_disable_f), 1); break;
+        case NOP: break;
+
+        default:
+            VNES_ASSERT(0 && "JIT tried to emit an instruction it can't translate");
+            break;
+    }
+}
+
+void JIT::emit_branch(Op op, uint16_t fallthrough_pc, uint32_t fallthrough_cycles, uint16_t target_pc, uint32_t target_cycles){
+    constexpr uint8_t JE = 0x74, JNE = 0x75;
+    // assume not taken, then overwrite the exit if the branch is taken
+    emit({0x66, 0xC7, modrm(1, 0, RDI), (uint8_t)offsetof(State, program_counter)}); emit16(fallthrough_pc);
+    emit({0xC7, modrm(1, 0, RDI), (uint8_t)offsetof(State, cycles)}); emit32(fallthrough_cycles);
+
+    uint8_t skip_taken = 0;
+    switch(op){
+        case BCC: case BCS:
+        case BVC: case BVS:
+            emit({0x80, modrm(1, 7, RDI), (uint8_t)((op == BCC || op == BCS) ? offsetof(State, carry_f) : offsetof(State, overflow_f)), 0}); // cmp byte [flag], 0
+            skip_taken = (op == BCS || op == BVS) ? JE : JNE;
+            break;
+        case BEQ: case BNE:
+            emit({0x80, modrm(1, 7, RDI), (uint8_t)offsetof(State, nz_result), 0}); // cmp byte [nz], 0 (Z set if low byte is 0)
+            skip_taken = (op == BEQ) ? JNE : JE;
+            break;
+        case BMI: case BPL:
+            emit({0x66, 0xF7, modrm(1, 0, RDI), (uint8_t)offsetof(State, nz_result)}); emit16(0x0180); // test word [nz], N bits
+            skip_taken = (op == BMI) ? JE : JNE;
+            break;
+        default:
+            VNES_ASSERT(0 && "JIT tried to emit a branch for a non-branch instruction");
+            break;
+    }
+
+    emit({skip_taken, 13}); // over the two moves below
+    emit({0x66, 0xC7, modrm(1, 0, RDI), (uint8_t)offsetof(State, program_counter)}); emit16(target_pc);
+    emit({0xC7, modrm(1, 0, RDI), (uint8_t)offsetof(State, cycles)}); emit32(target_cycles);
+    emit({0xC3}); // ret
+}
+
+void JIT::emit_exit(uint16_t next_pc, uint32_t cycles){
+    emit({0x66, 0xC7, modrm(1, 0, RDI), (uint8_t)offsetof(State, program_counter)}); emit16(next_pc);
+    emit({0xC7, modrm(1, 0, RDI), (uint8_t)offsetof(State, cycles)}); emit32(cycles);
+    emit({0xC3}); // ret
+}
+
+void JIT::emit(std::initializer_list<uint8_t> bytes){
+    code.insert(code.end(), bytes);
+}
+
+void JIT::emit16(uint16_t value){
+    emit({(uint8_t)value, (uint8_t)(value >> 8)});
+}
+
+void JIT::emit32(uint32_t value){
+    emit({(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)});
+}
+
+void JIT::load_field(Reg r, size_t field){
+    emit({0x0F, 0xB6, modrm(1, r, RDI), (uint8_t)field}); // movzx r32, byte [rdi+field]
+}
+
+void JIT::store_field(Reg r, size_t field){
+    emit({0x88, modrm(1, r, RDI), (uint8_t)field}); // mov byte [rdi+field], r8
+}
+
+void JIT::store_field_imm(size_t field, uint8_t value){
+    emit({0xC6, modrm(1, 0, RDI), (uint8_t)field, value}); // mov byte [rdi+field], imm8
+}
+
+void JIT::store_nz(Reg r){
+    emit({0x66, 0x89, modrm(1, r, RDI), (uint8_t)offsetof(State, nz_result)}); // mov word [rdi+nz], r16
+}
+
+void JIT::zero_extend(Reg dst, Reg src){
+    emit({0x0F, 0xB6, modrm(3, dst, src)}); // movzx r32, r8
+}
+
+void JIT::address_to_edx(Operand operand){
+    if(operand.mode != ZPGX && operand.mode != ZPGY){ return; }
+    // the interpreter doesn't wrap zero page indexing, and internal RAM mirrors every 0x800
+    load_field(EDX, operand.mode == ZPGX ? offsetof(State, index_X) : offsetof(State, index_Y));
+    emit({0x81, modrm(3, 0, EDX)}); emit32(operand.value); // add edx, imm32
+    emit({0x81, modrm(3, 4, EDX)}); emit32(0x07FF); // and edx, 0x7FF
+}
+
+void JIT::load_operand(Reg r, Operand operand){
+    switch(operand.mode){
+        case IMM:
+            emit({(uint8_t)(0xB8 + r)}); emit32(operand.value); // mov r32, imm32
+            break;
+        case ZPG:
+        case ABS:
+            emit({0x0F, 0xB6, modrm(2, r, RSI)}); emit32(operand.value & 0x07FF); // movzx r32, byte [rsi+addr]
+            break;
+        case ZPGX:
+        case ZPGY:
+            address_to_edx(operand);
+            emit({0x0F, 0xB6, modrm(0, r, 4), 0x16}); // movzx r32, byte [rsi+rdx]
+            break;
+        default:
+            VNES_ASSERT(0 && "JIT operand has no value to load");
+            break;
+    }
+}
+
+void JIT::store_operand(Reg r, Operand operand){
+    switch(operand.mode){
+        case ZPG:
+        case ABS:
+            emit({0x88, modrm(2, r, RSI)}); emit32(operand.value & 0x07FF); // mov byte [rsi+addr], r8
+            break;
+        case ZPGX:
+        case ZPGY:
+            emit({0x88, modrm(0, r, 4), 0x16}); // mov byte [rsi+rdx], r8
+            break;
+        default:
+            VNES_ASSERT(0 && "JIT operand can't be stored to");
+            break;
+    }
+}
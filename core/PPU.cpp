@@ -3,10 +3,24 @@
 #include "include/PPU.hpp"
 #include "../common/log.hpp"
 #include <algorithm>
+#include <string.h>
+#include <fstream>
 
 //PPU::PPU(RAM& _ram, Cartridge& _cart): ram {_ram}, cart {_cart} { 
-PPU::PPU(Cartridge& _cart, DMABus& _dmabus): cart {_cart}, dmabus {_dmabus} { 
+#if defined(VNES_RENDER_THREAD)
+PPU::PPU(Cartridge& _cart, DMABus& _dmabus, Scheduler& _scheduler): PPU(_cart, _dmabus, _scheduler, false) {
+    replica.reset(new PPU(cart, dmabus, replica_scheduler, true));
+    log_mapped_pages(); // the replica starts out with its own copy of VRAM
+    render_thread = std::thread(&PPU::render_thread_main, this);
+    VNES_LOG::LOG(VNES_LOG::INFO, "Started PPU render thread");
+}
+
+PPU::PPU(Cartridge& _cart, DMABus& _dmabus, Scheduler& _scheduler, bool _replica): cart {_cart}, dmabus {_dmabus}, scheduler {_scheduler}, is_replica {_replica} { 
+#else
+PPU::PPU(Cartridge& _cart, DMABus& _dmabus, Scheduler& _scheduler): cart {_cart}, dmabus {_dmabus}, scheduler {_scheduler} { 
+#endif
     VNES_LOG::LOG(VNES_LOG::INFO, "Constructing PPU");
+    set_palette(SYSTEM_PALETTE);
     power_up();
     VNES_LOG::LOG(VNES_LOG::INFO, "Done constructing PPU");
 }
@@ -35,6 +49,11 @@ uint8_t PPU::register_read(uint16_t addr){
             data = open_bus;
 			break;
         case PPU_STATUS:	// R 	PPU Status
+#if defined(VNES_RENDER_THREAD)
+            if(renders_on_thread()){
+                log_render_event(RenderEvent::REGISTER_READ, addr);
+            }
+#endif
             data = ppu_status;
 
             reg_w = 0; // reading PPU_STATUS resets the w register
@@ -56,19 +75,26 @@ uint8_t PPU::register_read(uint16_t addr){
             data = open_bus;
 			break;
         case PPU_DATA:	// R/W 	PPU Data
-            data = ppu_data_read_buffer;
-
-            if(ppu_addr <= 0x1FFF){
-                ppu_data_read_buffer = cart.read_pallete(ppu_addr);
-            }else{
-                ppu_data_read_buffer = vram[ppu_addr];
+#if defined(VNES_RENDER_THREAD)
+            if(renders_on_thread()){
+                log_render_event(RenderEvent::REGISTER_READ, addr);
+            }
+#endif
+            if(line_mode == SCANLINE && in_fetch_window()){
+                switch_to_dot_mode(); // reg_v is about to move under the renderer
             }
 
-            if(ppu_ctrl | 0x04){ // after access, addr increments by 1 or 32, specified by bit 2 of PPU_CTRL
-                ppu_addr += 32;
+            if((reg_v & 0x3FFF) >= 0x3F00){
+                // palette reads aren't buffered, but still fill the buffer
+                // with the nametable byte "underneath" the palette
+                data = vram_read(reg_v);
+                ppu_data_read_buffer = vram_read(reg_v - 0x1000);
             }else{
-                ppu_addr++;
+                data = ppu_data_read_buffer;
+                ppu_data_read_buffer = vram_read(reg_v);
             }
+
+            reg_v += (ppu_ctrl & 0x04) ? 32 : 1; // after access, addr increments by 1 or 32, specified by bit 2 of PPU_CTRL
 			break;
         case PPU_OAM_DMA:	// W 	Sprite Page DMA Transfer 
             VNES_LOG::LOG(VNES_LOG::WARN, "Attempted to read from write-only register at address 0x%x -> 0x%x", addr, mod_addr);
@@ -94,6 +120,12 @@ void PPU::register_write(uint16_t addr, uint8_t data){
         mod_addr = (addr % 0x8) + 0x2000; // the RAM address range for PPU registers mirrors every 8 bytes
     }
 
+#if defined(VNES_RENDER_THREAD)
+    if(renders_on_thread() && mod_addr != PPU_OAM_DMA){
+        log_render_event(RenderEvent::REGISTER_WRITE, addr, data); // OAM DMA is logged with its page below
+    }
+#endif
+
     // Some registers are write-locked for about 29658 CPU cycles after reset
     // 29658*3 = 88974 ppu cycles
     //
@@ -109,10 +141,28 @@ void PPU::register_write(uint16_t addr, uint8_t data){
         return;
     }
 
+    // anything written while a line is being fetched can change what it
+    // looks like from this dot on, see LineMode
+    if(line_mode == SCANLINE && mod_addr != PPU_OAM_DMA && in_fetch_window()){
+        switch_to_dot_mode();
+    }
+
     // TODO: check for read-only registers
     switch(mod_addr){
         case PPU_CTRL:	// W 	PPU Control 1
+            // NMI is raised on the rising edge of (NMI enable && vblank), so
+            // enabling it in the middle of vblank raises it straight away
+            if(!(ppu_ctrl & 0x80) && (data & 0x80) && (ppu_status & 0x80)){
+                scheduler.raise_nmi();
+            }
+            if((ppu_ctrl ^ data) & 0x20){
+                sprite_lists_stale = true; // sprite height changed
+            }
+            if((ppu_ctrl ^ data) & 0x10){
+                invalidate_whole_bitmap(); // background pattern table changed
+            }
             ppu_ctrl = data;
+            reg_t = (reg_t & 0xF3FF) | ((data & 0x03) << 10); // base nametable
 			break;
         case PPU_MASK:	// W 	PPU Control 2
             ppu_mask = data;
@@ -124,72 +174,83 @@ void PPU::register_write(uint16_t addr, uint8_t data){
             ppu_oam_addr = data;
 			break;
         case PPU_OAM_DATA:	// R/W 	OAM Data
+            if((ppu_oam_addr & 0x03) == 0 && OAM_PRIMARY[ppu_oam_addr] != data){
+                sprite_lists_stale = true; // a sprite moved vertically
+            }
             OAM_PRIMARY[ppu_oam_addr] = data;
             ppu_oam_addr++; // writes automatically increment PPU_OAM_ADDR
 			break;
         case PPU_SCROLL:	// W 2x 	Background Scroll Position \newline (write X then Y)
-            // PPU_SCROLL is 16 bits wide writing to PPU_SCROLL 
-            
-            // t register? x register?
+            // see https://www.nesdev.org/wiki/PPU_scrolling#Register_controls
             if(!(reg_w & 0x1)){
-                // w=0, first write, X scroll bits
-                ppu_scroll &= 0xFF00; // preserve bits 15-8 and clear 7-0
-                ppu_scroll |= data; // update 7-0
+                // w=0, first write, X scroll: coarse X into t, fine X into x
+                reg_t = (reg_t & 0xFFE0) | (data >> 3);
+                reg_x = data & 0x07;
                 reg_w = 1;
             }else{
-                // w=1, second write, Y scroll bits
-                ppu_scroll &= 0x00FF; // preserve bits 7-0 and clear 15-8
-                ppu_scroll |= (data << 8); // update bits 15-8
+                // w=1, second write, Y scroll: fine Y and coarse Y into t
+                reg_t = (reg_t & 0x8C1F) | ((data & 0x07) << 12) | ((data & 0xF8) << 2);
                 reg_w = 0;
             }
 			break;
         case PPU_ADDR:	// W 2x 	PPU Address \newline (write upper then lower)
-            // t register? v register?
             if(!(reg_w & 0x1)){
-                // w=0, first write, high byte
-                ppu_addr &= 0x00FF; // preserve bits 7-0 and clear 15-8
-                ppu_scroll |= (data << 8); // update 15-8
+                // w=0, first write, high byte (bit 14 is cleared)
+                reg_t = (reg_t & 0x00FF) | ((data & 0x3F) << 8);
                 reg_w = 1;
             }else{
-                // w=1, second write, low byte
-                ppu_scroll &= 0xFF00; // preserve bits 15-8 and clear 7-0
-                ppu_scroll |= data; // update bits 7-0
+                // w=1, second write, low byte, and t is copied to v
+                reg_t = (reg_t & 0xFF00) | data;
+                reg_v = reg_t;
                 reg_w = 0;
             }
 			break;
         case PPU_DATA:	// R/W 	PPU Data
-            // After access, the video memory address will increment by an amount determined by bit 2 of $2000. 
-            // v register?
-
-            if(ppu_addr <= 0x1FFF){
-                cart.write_pallete(addr, data);
-            }else{
-                vram[ppu_addr] = data;
-            }
-
-            if(ppu_ctrl | 0x04){ // after access, addr increments by 1 or 32, specified by bit 2 of PPU_CTRL
-                ppu_addr += 32;
-            }else{
-                ppu_addr++;
-            }
+            vram_write(reg_v, data);
+            reg_v += (ppu_ctrl & 0x04) ? 32 : 1; // after access, addr increments by 1 or 32, specified by bit 2 of PPU_CTRL
 			break;
         case PPU_OAM_DMA:	// W 	Sprite Page DMA Transfer 
 			/* handler */
 
             // DMA is 256 pairs of READ FROM RAM (starting from address 0x[data]00) and writing to OAMDATA (will use current OAMADDR, programmer's responsibility to set proper starting address)
-            for(int i = 0x0; i <= 0xFF; i++){
-                // DMABus reads, OMADATA writes
-                uint8_t current_addr = (data << 8) | i;
-                register_write(PPU_OAM_DATA, dmabus.read(current_addr));
+            {
+                uint8_t page[0x100];
+#if defined(VNES_RENDER_THREAD)
+                if(replaying()){
+                    memcpy(page, replay_dma_page, 0x100);
+                }else{
+                    dmabus.read_page(data, page);
+                }
+                if(renders_on_thread()){
+                    log_render_event(RenderEvent::REGISTER_WRITE, addr, data, page, 0x100);
+                }
+#else
+                dmabus.read_page(data, page);
+#endif
+                // OAMADDR wraps around, and ends up where it started
+                uint8_t oam[0x100];
+                memcpy(&oam[ppu_oam_addr], page, 0x100 - ppu_oam_addr);
+                memcpy(oam, &page[0x100 - ppu_oam_addr], ppu_oam_addr);
+                // games copy OAM every frame whether or not anything moved
+                for(int i = 0; i < 0x100 && !sprite_lists_stale; i += 4){
+                    sprite_lists_stale = oam[i] != OAM_PRIMARY[i];
+                }
+                memcpy(OAM_PRIMARY, oam, 0x100);
             }
 
-            VNES_LOG::LOG(VNES_LOG::WARN, "PPU OAM DMA should add 514 cycles to the CPU");
+            // the CPU is halted for 513 cycles, plus one to line up with a
+            // read cycle if the DMA started on an odd one
+            // see https://www.nesdev.org/wiki/PPU_registers#OAMDMA
+            scheduler.stall_cpu(513 + ((timestamp / Scheduler::CPU_CLOCK_DIVIDER) & 1));
             
 			break;
         default:
             VNES_LOG::LOG(VNES_LOG::ERROR, "Tried to read to bad PPU register address 0x%x", mod_addr);
             break;
     }
+
+    // the write may have moved sprite 0 or turned rendering on or off
+    schedule_status();
 }
 
 /*
@@ -204,58 +265,676 @@ void PPU::register_write(uint16_t addr, uint8_t data){
  *          https://www.nesdev.org/wiki/PPU_pattern_tables
  */
 
+// Pattern pages come from the mapper and are remapped whenever it bumps its
+// CHR generation. Nametable pages come from the cartridge's mirroring.
+void PPU::map_vram(){
+    for(int page = 0; page < 8; page++){
+        uint8_t* chr = cart.chr_page(page);
+        vram_pages[page] = chr ? chr : unmapped_page;
+    }
+    for(int table = 0; table < 4; table++){
+        uint8_t* nametable = cart.nametable_page(table, ciram);
+        vram_pages[8 + table] = nametable ? nametable : unmapped_page;
+        vram_pages[12 + table] = vram_pages[8 + table]; // 0x3000 - 0x3EFF mirrors 0x2000 - 0x2EFF
+    }
+    seen_chr_generation = cart.chr_generation();
+    std::fill(std::begin(tile_valid), std::end(tile_valid), false); // the patterns behind every tile may have changed
+    invalidate_whole_bitmap();
+#if defined(VNES_RENDER_THREAD)
+    if(renders_on_thread()){
+        log_mapped_pages(); // the replica switches banks at the same dot
+    }
+#endif
+}
+
+const uint8_t* PPU::tile_row(uint16_t addr, bool flipped){
+    const uint16_t tile = (addr >> 4) & 0x1FF;
+    if(!tile_valid[tile]){
+        decode_tile(tile);
+    }
+    return tile_cache[flipped][tile * 8 + (addr & 0x07)];
+}
+
+// see https://www.nesdev.org/wiki/PPU_pattern_tables, the low plane of a
+// row is at +0 and the high plane at +8
+void PPU::decode_tile(uint16_t tile){
+    const uint8_t* planes = &vram_pages[tile >> 6][(tile & 0x3F) << 4];
+    pixel_kernels.decode_tile(planes, tile_cache[0][tile * 8], tile_cache[1][tile * 8]);
+    tile_valid[tile] = true;
+}
+
+// 0x3F10, 0x3F14, 0x3F18 and 0x3F1C mirror 0x3F00, 0x3F04, 0x3F08 and 0x3F0C
+// see https://www.nesdev.org/wiki/PPU_palettes#Memory_Map
+uint8_t& PPU::palette_entry(uint16_t addr){
+    uint8_t index = addr & 0x1F;
+    if((index & 0x13) == 0x10){
+        index &= 0x0F;
+    }
+    return palette_ram[index];
+}
+
 // private read function, only used by PPU itself
 uint8_t PPU::vram_read(uint16_t addr){
     uint16_t addr_14b = addr & 0x3FFF; // VRAM address line is only 14 bits wide
-    uint8_t data = 0;
-    switch(addr){
-        case 0x0000 ... 0x1FFF:
-            // 
-            data = cart.read_pallete(addr_14b);
-            break;
-
-        default:
-            data = vram[addr_14b];
-            break;
+    if(addr_14b >= 0x3F00){
+        return palette_entry(addr_14b);
     }
-
-    return data;
+    return vram_pages[addr_14b >> 10][addr_14b & 0x3FF];
 }
 
 // private write function, only used by PPU itself
 void PPU::vram_write(uint16_t addr, uint8_t data){
     uint16_t addr_14b = addr & 0x3FFF; // VRAM address line is only 14 bits wide
-    switch(addr){
-        case 0x0000 ... 0x1FFF:
-            // 
-            VNES_LOG::LOG(VNES_LOG::ERROR, "Attempted to write to CHR ROM address 0x%x (16 bit address was 0x%x)", addr_14b, addr);
+    if(addr_14b >= 0x3F00){
+        palette_entry(addr_14b) = data;
+        return;
+    }
+    vram_pages[addr_14b >> 10][addr_14b & 0x3FF] = data;
+    if(addr_14b < 0x2000){
+        tile_valid[addr_14b >> 4] = false; // CHR-RAM
+        if((addr_14b & 0x1000) == background_table()){
+            bitmap_pattern_stale[(addr_14b >> 4) & 0xFF] = true;
+            bitmap_patterns_stale = true;
+        }
+    }else{
+        invalidate_bitmap(addr_14b);
+    }
+}
+
+/* rendering */
+
+// 2C02 colours as 0xRRGGBB, see https://www.nesdev.org/wiki/PPU_palettes
+const uint32_t PPU::SYSTEM_PALETTE[64] = {
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+    0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+    0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+    0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+    0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+    0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+    0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000
+};
+
+// see https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+uint16_t PPU::increment_coarse_x(uint16_t v){
+    if((v & 0x001F) == 31){
+        v &= ~0x001F;
+        v ^= 0x0400; // next horizontal nametable
+    }else{
+        v++;
+    }
+    return v;
+}
+
+uint16_t PPU::increment_y(uint16_t v){
+    if((v & 0x7000) != 0x7000){
+        return v + 0x1000; // fine Y
+    }
+    v &= ~0x7000;
+    int coarse_y = (v & 0x03E0) >> 5;
+    if(coarse_y == 29){
+        coarse_y = 0;
+        v ^= 0x0800; // next vertical nametable
+    }else if(coarse_y == 31){
+        coarse_y = 0; // attribute rows wrap without switching nametables
+    }else{
+        coarse_y++;
+    }
+    return (v & ~0x03E0) | (coarse_y << 5);
+}
+
+// The window starts at dot 321 of the line before (dot 1 for the pre-render
+// line) and ends at dot 256. The dot at (scanline, dot) hasn't run yet.
+bool PPU::in_fetch_window() const {
+    if(scanline > 239){
+        return false;
+    }
+    if(dot >= 322){
+        return true;
+    }
+    if(scanline == -1){
+        return dot >= 2 && dot <= 256;
+    }
+    return dot <= 256;
+}
+
+// Rewinds the current line to the start of its fetch window and replays it
+// in dot mode up to where the PPU is now
+void PPU::switch_to_dot_mode(){
+    const int end_scanline = scanline;
+    const int end_dot = dot;
+    if(dot >= 321){
+        dot = 321;
+    }else if(scanline == -1){
+        dot = 1;
+    }else{
+        scanline--;
+        dot = 321;
+    }
+
+    reg_v = window_v;
+    line_mode = DOT;
+    sprite0_hit_dot = -1;
+    while(scanline != end_scanline || dot != end_dot){
+        render_dot();
+        advance_dot();
+    }
+}
+
+// What the scanline renderer does on each dot: everything the dot renderer
+// would do, but in bulk on the dot where it finishes
+void PPU::render_scanline_dot(){
+    if(scanline == sprite0_hit_line && dot == sprite0_hit_dot){
+        ppu_status |= 0x40;
+    }
+
+    switch(dot){
+        case 1:
+            if(scanline == -1){
+                window_v = reg_v;
+            }
+            break;
+
+        case 256:
+            if(rendering_enabled()){
+                // coarse X was incremented 32 times, which comes back to
+                // where it started in the other horizontal nametable
+                reg_v = increment_y(reg_v ^ 0x0400);
+            }
+            break;
+
+        case 257:
+            if(rendering_enabled()){
+                reg_v = (reg_v & ~0x041F) | (reg_t & 0x041F); // horizontal bits of t to v
+                if(scanline < 239){
+                    evaluate_sprites(scanline + 1);
+                }
+            }
+            break;
+
+        case 280 ... 304:
+            if(scanline == -1 && rendering_enabled()){
+                reg_v = (reg_v & ~0x7BE0) | (reg_t & 0x7BE0); // vertical bits of t to v
+            }
+            break;
+
+        case 321:
+            window_v = reg_v;
+            if(scanline < 239){
+                render_line(scanline + 1);
+            }
+            break;
+
+        case 336:
+            if(rendering_enabled()){
+                reg_v = increment_coarse_x(increment_coarse_x(reg_v)); // the first two tiles of the next line
+            }
             break;
 
         default:
-            vram[addr_14b] = data;
             break;
     }
 }
 
-bool PPU::check_nmi(){
-    //return (internal_read(PPU_CTRL) & 0x80) && (internal_read(PPU_STATUS) & 0x80);
-    return (ppu_ctrl & 0x80) && (ppu_status & 0x80);
+// One dot of the background pipeline, see https://www.nesdev.org/wiki/PPU_rendering
+void PPU::render_dot(){
+    const bool visible = scanline >= 0 && dot >= 1 && dot <= 256;
+    if(!rendering_enabled()){
+        if(visible){
+            put_pixel(scanline, dot - 1, 0);
+        }
+        return;
+    }
+
+    if((dot >= 2 && dot <= 257) || (dot >= 321 && dot <= 337)){
+        bg_shift_pattern_lo <<= 1;
+        bg_shift_pattern_hi <<= 1;
+        bg_shift_attrib_lo <<= 1;
+        bg_shift_attrib_hi <<= 1;
+
+        switch((dot - 1) % 8){
+            case 0:
+                load_background_shifters();
+                next_tile_id = vram_read(0x2000 | (reg_v & 0x0FFF));
+                break;
+            case 2:
+                next_tile_attrib = vram_read(0x23C0 | (reg_v & 0x0C00) | ((reg_v >> 4) & 0x38) | ((reg_v >> 2) & 0x07));
+                if(reg_v & 0x0040){ next_tile_attrib >>= 4; } // bottom half of the 32x32 area
+                if(reg_v & 0x0002){ next_tile_attrib >>= 2; } // right half
+                next_tile_attrib &= 0x03;
+                break;
+            case 4:
+                next_tile_lo = vram_read(background_table() + (next_tile_id << 4) + ((reg_v >> 12) & 0x07));
+                break;
+            case 6:
+                next_tile_hi = vram_read(background_table() + (next_tile_id << 4) + ((reg_v >> 12) & 0x07) + 8);
+                break;
+            case 7:
+                reg_v = increment_coarse_x(reg_v);
+                break;
+            default:
+                break;
+        }
+    }
+
+    if(dot == 256){
+        reg_v = increment_y(reg_v);
+    }
+    if(dot == 257){
+        load_background_shifters();
+        reg_v = (reg_v & ~0x041F) | (reg_t & 0x041F);
+        if(scanline < 239){
+            evaluate_sprites(scanline + 1);
+        }
+    }
+    if(scanline == -1 && dot >= 280 && dot <= 304){
+        reg_v = (reg_v & ~0x7BE0) | (reg_t & 0x7BE0);
+    }
+
+    if(visible){
+        const uint16_t mux = 0x8000 >> reg_x;
+        uint8_t bg = ((bg_shift_pattern_hi & mux) ? 0x02 : 0) | ((bg_shift_pattern_lo & mux) ? 0x01 : 0)
+                   | ((bg_shift_attrib_hi & mux) ? 0x08 : 0) | ((bg_shift_attrib_lo & mux) ? 0x04 : 0);
+        bool sprite0_hit = false;
+        put_pixel(scanline, dot - 1, compose_pixel(dot - 1, bg, sprite0_hit));
+        if(sprite0_hit){
+            ppu_status |= 0x40;
+        }
+    }
+}
+
+void PPU::load_background_shifters(){
+    bg_shift_pattern_lo = (bg_shift_pattern_lo & 0xFF00) | next_tile_lo;
+    bg_shift_pattern_hi = (bg_shift_pattern_hi & 0xFF00) | next_tile_hi;
+    bg_shift_attrib_lo  = (bg_shift_attrib_lo & 0xFF00) | ((next_tile_attrib & 0x01) ? 0xFF : 0x00);
+    bg_shift_attrib_hi  = (bg_shift_attrib_hi & 0xFF00) | ((next_tile_attrib & 0x02) ? 0xFF : 0x00);
+}
+
+// Draws a whole line from the registers as they are at the start of its
+// fetch window. Tile k of the line is the one at window_v after k coarse X
+// increments, and pixel x comes from column x + fine X of those tiles. The
+// background and sprites are drawn into separate rows and merged by
+// pixel_kernels, see compose_pixel() for the rules.
+void PPU::render_line(int line){
+    sprite0_hit_line = line;
+    sprite0_hit_dot = -1;
+
+    if(!rendering_enabled()){
+        const uint8_t backdrop[256] = {};
+        put_line(line, backdrop);
+        return;
+    }
+    if(!draws_pixels() && !(line_sprite_count && line_sprites[0].sprite0)){
+        return; // sprite 0 hit is all that's needed from the line
+    }
+
+    uint8_t bg[256];
+    if(ppu_mask & 0x08){
+        if(((reg_v >> 5) & 0x1F) < 30){
+            background_from_bitmap(bg);
+        }else{
+            background_from_tiles(bg); // coarse Y 30 and 31 fetch attributes as tiles
+        }
+        if(!(ppu_mask & 0x02)){
+            memset(bg, 0, 8); // left 8 pixels hidden
+        }
+    }else{
+        memset(bg, 0, 256);
+    }
+
+    uint8_t sprites[256 + 8] = {}; // room for a sprite hanging off the right edge
+    if(ppu_mask & 0x10){
+        // backwards, so the first sprite in OAM order is the one left in
+        // front where sprites overlap
+        for(int i = line_sprite_count - 1; i >= 0; i--){
+            const Sprite& sprite = line_sprites[i];
+            const uint8_t base = 0x10 | ((sprite.attributes & 0x03) << 2) | (sprite.attributes & 0x20 ? PixelKernels::SPRITE_BEHIND : 0);
+            for(int col = 0; col < 8; col++){
+                if(sprite.pixels[col]){
+                    sprites[sprite.x + col] = base | sprite.pixels[col];
+                }
+            }
+        }
+        if(!(ppu_mask & 0x04)){
+            memset(sprites, 0, 8);
+        }
+
+        // sprite 0 is always first, so it's in front wherever it's opaque
+        if(line_sprite_count && line_sprites[0].sprite0 && !(ppu_status & 0x40)){
+            const Sprite& sprite = line_sprites[0];
+            for(int x = sprite.x; x < std::min(sprite.x + 8, 255); x++){
+                if(sprite.pixels[x - sprite.x] && (sprites[x] & 0x03) && (bg[x] & 0x03)){
+                    sprite0_hit_dot = x + 1; // pixel x comes out on dot x + 1
+                    break;
+                }
+            }
+        }
+    }
+
+    if(line >= 8 && line < 232 && draws_pixels()){
+        uint8_t indices[256];
+        pixel_kernels.compose(bg, sprites, indices, 256);
+        put_line(line, indices);
+    }
+}
+
+// Background of the line starting at reg_v, fetched tile by tile
+void PPU::background_from_tiles(uint8_t* bg){
+    uint8_t tiles[33 * 8];
+    uint16_t v = reg_v;
+    const uint16_t fine_y = (v >> 12) & 0x07;
+    for(int tile = 0; tile < 33; tile++){
+        uint8_t id = vram_read(0x2000 | (v & 0x0FFF));
+        uint8_t attrib = vram_read(0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        if(v & 0x0040){ attrib >>= 4; }
+        if(v & 0x0002){ attrib >>= 2; }
+        attrib = (attrib & 0x03) << 2;
+        const uint8_t* pixels = tile_row(background_table() + (id << 4) + fine_y, false);
+        for(int col = 0; col < 8; col++){
+            tiles[tile * 8 + col] = attrib | pixels[col];
+        }
+        v = increment_coarse_x(v);
+    }
+    memcpy(bg, &tiles[reg_x], 256);
+}
+
+// Background of the line starting at reg_v, cut out of nametable_bitmap.
+// The 33 tiles the line touches are redrawn first if they're out of date.
+void PPU::background_from_bitmap(uint8_t* bg){
+    if(bitmap_patterns_stale){
+        // tiles drawn with patterns that have since been written to
+        for(int table = 0; table < 4; table++){
+            const uint8_t* nametable = vram_pages[8 + table];
+            for(int tile = 0; tile < 30 * 32; tile++){
+                if(bitmap_pattern_stale[nametable[tile]]){
+                    bitmap_tile_valid[table][tile] = false;
+                }
+            }
+        }
+        std::fill(std::begin(bitmap_pattern_stale), std::end(bitmap_pattern_stale), false);
+        bitmap_patterns_stale = false;
+    }
+
+    const int coarse_y = (reg_v >> 5) & 0x1F;
+    const int row = ((reg_v >> 11) & 0x01) * 240 + coarse_y * 8 + ((reg_v >> 12) & 0x07);
+    const int first_column = ((reg_v >> 10) & 0x01) * 32 + (reg_v & 0x1F); // in tiles, across both horizontal nametables
+    for(int k = 0; k < 33; k++){
+        const int column = (first_column + k) & 0x3F;
+        const int table = ((reg_v >> 10) & 0x02) | (column >> 5);
+        const int tile = coarse_y * 32 + (column & 0x1F);
+        if(!bitmap_tile_valid[table][tile]){
+            draw_bitmap_tile(table, tile);
+        }
+    }
+
+    const int x = (first_column * 8 + reg_x) & 0x1FF;
+    const int first_part = std::min(256, 512 - x);
+    memcpy(bg, &nametable_bitmap[row][x], first_part);
+    memcpy(&bg[first_part], &nametable_bitmap[row][0], 256 - first_part); // wrapped around to the left nametable
+}
+
+void PPU::draw_bitmap_tile(int table, int tile){
+    const uint8_t* nametable = vram_pages[8 + table];
+    const int coarse_x = tile & 0x1F;
+    const int coarse_y = tile >> 5;
+    uint8_t attrib = nametable[0x3C0 | ((coarse_y >> 2) << 3) | (coarse_x >> 2)];
+    if(coarse_y & 0x02){ attrib >>= 4; }
+    if(coarse_x & 0x02){ attrib >>= 2; }
+    attrib = (attrib & 0x03) << 2;
+
+    const uint16_t pattern = background_table() + (nametable[tile] << 4);
+    for(int fine_y = 0; fine_y < 8; fine_y++){
+        const uint8_t* pixels = tile_row(pattern + fine_y, false);
+        uint8_t* out = &nametable_bitmap[(table >> 1) * 240 + coarse_y * 8 + fine_y][(table & 0x01) * 256 + coarse_x * 8];
+        for(int col = 0; col < 8; col++){
+            out[col] = attrib | pixels[col];
+        }
+    }
+    bitmap_tile_valid[table][tile] = true;
+}
+
+// A write to nametable memory at addr changes a tile, or the 4x4 tiles an
+// attribute byte covers, in every nametable that shows that memory
+void PPU::invalidate_bitmap(uint16_t addr){
+    const uint8_t* page = vram_pages[addr >> 10];
+    const int offset = addr & 0x3FF;
+    for(int table = 0; table < 4; table++){
+        if(vram_pages[8 + table] != page){
+            continue;
+        }
+        if(offset < 0x3C0){
+            bitmap_tile_valid[table][offset] = false;
+            continue;
+        }
+        const int top = ((offset - 0x3C0) >> 3) * 4;
+        const int left = ((offset - 0x3C0) & 0x07) * 4;
+        for(int coarse_y = top; coarse_y < std::min(top + 4, 30); coarse_y++){
+            for(int coarse_x = left; coarse_x < left + 4; coarse_x++){
+                bitmap_tile_valid[table][coarse_y * 32 + coarse_x] = false;
+            }
+        }
+    }
+}
+
+// Sorts the 64 sprites into the lines they cover, the first 8 of each line
+// in OAM order
+void PPU::update_sprite_lists(){
+    const int height = (ppu_ctrl & 0x20) ? 16 : 8;
+    std::fill(std::begin(sprite_list_length), std::end(sprite_list_length), 0);
+    std::fill(std::begin(sprite_list_overflow), std::end(sprite_list_overflow), false);
+    for(int i = 0; i < 64; i++){
+        const int top = OAM_PRIMARY[i * 4] + 1; // sprites are drawn a line below their Y
+        for(int line = top; line < std::min(top + height, 240); line++){
+            if(sprite_list_length[line] == 8){
+                sprite_list_overflow[line] = true;
+            }else{
+                sprite_lists[line][sprite_list_length[line]++] = i;
+            }
+        }
+    }
+    sprite_lists_stale = false;
+}
+
+// Fetches the patterns of the first 8 sprites on line, which on hardware
+// happens over dots 65-320 of the line before
+void PPU::evaluate_sprites(int line){
+    if(sprite_lists_stale){
+        update_sprite_lists();
+    }
+    if(sprite_list_overflow[line]){
+        ppu_status |= 0x20;
+    }
+
+    // without pixels to draw, only sprite 0 is needed, and then only if
+    // it's on the line
+    int count = sprite_list_length[line];
+    if(!draws_pixels()){
+        count = (count && sprite_lists[line][0] == 0) ? 1 : 0;
+    }
+
+    const int height = (ppu_ctrl & 0x20) ? 16 : 8;
+    line_sprite_count = 0;
+    for(int n = 0; n < count; n++){
+        const int i = sprite_lists[line][n];
+        const uint8_t* entry = &OAM_PRIMARY[i * 4];
+        int row = line - 1 - entry[0];
+
+        const uint8_t tile = entry[1];
+        const uint8_t attributes = entry[2];
+        if(attributes & 0x80){
+            row = height - 1 - row; // vertical flip
+        }
+        uint16_t addr;
+        if(height == 16){
+            // bit 0 of the tile picks the pattern table, then top and bottom tiles
+            addr = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4) | ((row & 0x08) << 1) | (row & 0x07);
+        }else{
+            addr = ((ppu_ctrl & 0x08) << 9) | (tile << 4) | row;
+        }
+        Sprite& sprite = line_sprites[line_sprite_count++];
+        sprite.x = entry[3];
+        sprite.attributes = attributes;
+        sprite.sprite0 = i == 0;
+        memcpy(sprite.pixels, tile_row(addr, attributes & 0x40), 8); // bit 6 is horizontal flip
+    }
+}
+
+// Picks between the background pixel (attribute << 2 | pattern) and the
+// line's sprites. Returns an index into palette RAM.
+uint8_t PPU::compose_pixel(int x, uint8_t bg, bool& sprite0_hit){
+    if(!(ppu_mask & 0x08) || (x < 8 && !(ppu_mask & 0x02))){
+        bg = 0;
+    }
+    if(!(bg & 0x03)){
+        bg = 0; // transparent pixels show the backdrop colour
+    }
+
+    if((ppu_mask & 0x10) && (x >= 8 || (ppu_mask & 0x04))){
+        for(int i = 0; i < line_sprite_count; i++){
+            const Sprite& sprite = line_sprites[i];
+            int col = x - sprite.x;
+            if(col < 0 || col > 7){
+                continue;
+            }
+            uint8_t pixel = sprite.pixels[col];
+            if(!pixel){
+                continue;
+            }
+            if(sprite.sprite0 && bg && x != 255){
+                sprite0_hit = true;
+            }
+            if(bg && (sprite.attributes & 0x20)){
+                return bg; // sprite is behind the background
+            }
+            return 0x10 | ((sprite.attributes & 0x03) << 2) | pixel;
+        }
+    }
+    return bg;
+}
+
+// buffer has the 224 lines that NTSC TVs show, 8 to 231
+void PPU::put_pixel(int line, int x, uint8_t palette_index){
+    if(line < 8 || line >= 232 || !draws_pixels()){
+        return;
+    }
+    if(output_mode == INDEXED_OUTPUT){
+        indexed_buffer[(line - 8) * 256 + x] = palette_entry(0x3F00 | palette_index) & 0x3F;
+        indexed_variant[line - 8] = colour_variant();
+        return;
+    }
+    buffer[(line - 8) * 256 + x] = output_colour(palette_index);
+}
+
+// put_pixel() for a whole line, with the palette looked up once for it
+void PPU::put_line(int line, const uint8_t* palette_indices){
+    if(line < 8 || line >= 232 || !draws_pixels()){
+        return;
+    }
+    if(output_mode == INDEXED_OUTPUT){
+        uint8_t colours[32];
+        for(int i = 0; i < 32; i++){
+            colours[i] = palette_entry(0x3F00 | i) & 0x3F;
+        }
+        uint8_t* out = &indexed_buffer[(line - 8) * 256];
+        for(int x = 0; x < 256; x++){
+            out[x] = colours[palette_indices[x]];
+        }
+        indexed_variant[line - 8] = colour_variant();
+        return;
+    }
+    uint32_t colours[32];
+    for(int i = 0; i < 32; i++){
+        colours[i] = output_colour(i);
+    }
+    pixel_kernels.map_colours(palette_indices, colours, reinterpret_cast<uint32_t*>(&buffer[(line - 8) * 256]), 256);
+}
+
+// Colours are ABGR (0xAABBGGRR), what the frontend's texture expects, see
+// col2uint() in vannes.cpp
+uint32_t PPU::output_colour(uint8_t palette_index){
+    return colour_table[colour_variant()][palette_entry(0x3F00 | palette_index) & 0x3F];
+}
+
+void PPU::present(int* out){
+    for(int line = 0; line < 224; line++){
+        const uint32_t* colours = colour_table[indexed_variant[line]];
+        const uint8_t* in = &indexed_buffer[line * 256];
+        for(int x = 0; x < 256; x++){
+            out[line * 256 + x] = colours[in[x]];
+        }
+    }
+}
+
+// Grayscale keeps only the column 0 colours (0x00, 0x10, 0x20, 0x30) and
+// each emphasis bit darkens the two other channels, see
+// https://www.nesdev.org/wiki/PPU_palettes#Color_tint_bits. The factor is
+// an average, the real PPU's output depends on the colour.
+void PPU::set_palette(const uint32_t* rgb){
+    constexpr float EMPHASIS_ATTENUATION = 0.816328f;
+    for(int variant = 0; variant < 16; variant++){
+        const bool grayscale = variant & 0x01;
+        const int emphasis = variant >> 1; // bit 0 red, bit 1 green, bit 2 blue
+        const float red_scale   = (emphasis & 0x06) ? EMPHASIS_ATTENUATION : 1.0f;
+        const float green_scale = (emphasis & 0x05) ? EMPHASIS_ATTENUATION : 1.0f;
+        const float blue_scale  = (emphasis & 0x03) ? EMPHASIS_ATTENUATION : 1.0f;
+        for(int colour = 0; colour < 64; colour++){
+            const uint32_t c = rgb[grayscale ? (colour & 0x30) : colour];
+            const uint32_t r = (uint32_t)(((c >> 16) & 0xFF) * red_scale);
+            const uint32_t g = (uint32_t)(((c >> 8) & 0xFF) * green_scale);
+            const uint32_t b = (uint32_t)((c & 0xFF) * blue_scale);
+            colour_table[variant][colour] = 0xFF000000 | (b << 16) | (g << 8) | r;
+        }
+    }
+}
+
+bool PPU::load_palette(const std::string& filename){
+    using namespace VNES_LOG;
+
+    uint8_t data[64 * 3];
+    std::ifstream file {filename, std::ios::binary | std::ios::in};
+    if(!file.is_open() || !file.read(reinterpret_cast<char*>(data), sizeof(data))){
+        LOG(ERROR, "Failed to read 64 colours from palette file %s, keeping the current palette", filename.c_str());
+        return false;
+    }
+
+    uint32_t rgb[64];
+    for(int colour = 0; colour < 64; colour++){
+        rgb[colour] = (data[colour * 3] << 16) | (data[colour * 3 + 1] << 8) | data[colour * 3 + 2];
+    }
+    set_palette(rgb);
+    LOG(INFO, "Loaded palette from %s", filename.c_str());
+    return true;
 }
 
 void PPU::power_up(){
     VNES_LOG::LOG(VNES_LOG::INFO, "Powering up PPU");
+    timestamp = 0; // the PPU's clock keeps running through a reset, so it only starts here
     reset();
     ppu_oam_addr = 0x00;
-    ppu_addr = 0x00;
     ppu_data = 0x00;
+    reg_v = 0x0000;
+    reg_t = 0x0000;
+    reg_x = 0;
+    std::fill(std::begin(OAM_PRIMARY), std::end(OAM_PRIMARY), 0);
+    sprite_lists_stale = true;
 
-    std::fill(std::begin(vram), std::end(vram), 0);
+    std::fill(std::begin(ciram), std::end(ciram), 0);
+    std::fill(std::begin(palette_ram), std::end(palette_ram), 0);
+    std::fill(std::begin(unmapped_page), std::end(unmapped_page), 0);
+    std::fill(std::begin(bitmap_pattern_stale), std::end(bitmap_pattern_stale), false);
+    bitmap_patterns_stale = false;
+    map_vram();
 
     VNES_LOG::LOG(VNES_LOG::INFO, "Done powering up PPU");
 }
 
 void PPU::reset(){
     VNES_LOG::LOG(VNES_LOG::INFO, "Resetting PPU");
+#if defined(VNES_RENDER_THREAD)
+    if(renders_on_thread()){
+        log_render_event(RenderEvent::RESET);
+    }
+#endif
     cycles_since_reset = 0;
     frame_cycle = 0;
     //scanline_cycle = 0;
@@ -269,6 +948,8 @@ void PPU::reset(){
     for(int i = 0; i < 256*224; i++){
         buffer[i] = 0;
     }
+    std::fill(std::begin(indexed_buffer), std::end(indexed_buffer), 0);
+    std::fill(std::begin(indexed_variant), std::end(indexed_variant), 0);
     //vblank = false;
     frame_done = false;
     odd_frame = false;
@@ -276,171 +957,429 @@ void PPU::reset(){
 	ppu_ctrl = 0x00;
 	ppu_mask = 0x00;
 	ppu_status = 0x00;
-	ppu_scroll = 0x00;
 	ppu_data = 0x00;
+    ppu_data_read_buffer = 0x00;
+    reg_w = 0;
+
+    line_mode = SCANLINE;
+    window_v = 0;
+    skipping_frame = render_skip;
+    sprite0_hit_line = -2;
+    sprite0_hit_dot = -1;
+    line_sprite_count = 0;
+    bg_shift_pattern_lo = bg_shift_pattern_hi = 0;
+    bg_shift_attrib_lo = bg_shift_attrib_hi = 0;
+    next_tile_id = next_tile_attrib = next_tile_lo = next_tile_hi = 0;
+
+    schedule_vblank();
+    schedule_status();
 
     VNES_LOG::LOG(VNES_LOG::INFO, "PPU reset done");
 }
 
-void PPU::do_cycles(int cycles_to_do){
-    //VNES_LOG::LOG(VNES_LOG::DEBUG, "PPU cycle requested");
-    for(int i = 0; i < cycles_to_do; i++){
-        cycle();
+// dots until the dot at target_scanline, target_dot has run, wrapping
+// into the next frame if it has already passed
+int PPU::dots_until(int target_scanline, int target_dot){
+    constexpr int DOTS_PER_SCANLINE = 341;
+    constexpr int DOTS_PER_FRAME = 262 * DOTS_PER_SCANLINE;
+    const int target = (target_scanline + 1) * DOTS_PER_SCANLINE + target_dot; // counted from scanline -1
+
+    int position = (scanline + 1) * DOTS_PER_SCANLINE + dot;
+    int dots = target - position;
+    if(dots < 0){
+        dots += DOTS_PER_FRAME;
     }
+    // odd frames skip the last dot of the pre-render line, which lies
+    // ahead unless it has already been passed this frame
+    if(odd_frame && (position < DOTS_PER_SCANLINE - 1 || position > target)){
+        dots--;
+    }
+    return dots + 1;
 }
 
-void PPU::cycle(){
-    // see https://www.nesdev.org/wiki/PPU_rendering
+int PPU::dots_until_vblank(){
+    return dots_until(241, 1); // scanline 241, dot 1
+}
 
-    int dot_modulo = 0; // declare before entering switch
-    switch(scanline){
+void PPU::schedule_vblank(){
+    scheduler.schedule(Scheduler::PPU_VBLANK, timestamp + dots_until_vblank() * Scheduler::PPU_CLOCK_DIVIDER);
+}
 
-        //case 0 ... 239:
-        case -1 ... 239:
-            // pre-render line and visible lines
+// PPU_STATUS can be polled, so the CPU must not run past any change to it.
+// Vblank being set has an event of its own, this one covers the rest: the
+// flags being cleared at the end of vblank, sprite 0 hit and sprite overflow.
+void PPU::schedule_status(){
+    uint64_t next = std::min(next_sprite0_time(), next_overflow_time());
+    if(ppu_status & 0xE0){
+        next = std::min(next, timestamp + dots_until(-1, 1) * Scheduler::PPU_CLOCK_DIVIDER);
+    }
+    if(next == Scheduler::NEVER){
+        scheduler.cancel(Scheduler::PPU_STATUS);
+    }else{
+        scheduler.schedule(Scheduler::PPU_STATUS, next);
+    }
+}
 
-            /*
-             * The dummy line, -1 (aka 261) is included in this block since it
-             * behaves the same as scanlines 0-239 (loads the tile data into 
-             * the shift registers for scanline 0), but doesn't render
-             */
-            
-            switch(dot){
-                case 0:
-                    // idle cycle
-                    break;
+// Before sprite 0's line is drawn, the start of the line's fetch window,
+// when the scanline renderer finds out where the hit is, and after that the
+// hit itself. A line in dot mode has no idea until the dot happens, so the
+// CPU only gets to run a dot at a time.
+uint64_t PPU::next_sprite0_time(){
+    const int top = OAM_PRIMARY[0] + 1; // sprites are drawn a line below their Y
+    const int bottom = top + ((ppu_ctrl & 0x20) ? 16 : 8); // exclusive
 
-                case 1 ... 256:
-                    // fetch tile data
-                    
-                    /*
-                     * At the start of every scanline, the first two tiles are 
-                     * already loaded/ready for rendering since the previous 
-                     * scanline loads them. So the tile 3 is the first tile 
-                     * loaded this scanline.
-                     *
-                     * Loading a tile requires 4 memory access at 2 cycles/dots per access
-                     * (8 dots per tile). The 4 access are:
-                     *     - Nametable byte
-                     *     - Attribute byte
-                     *     - Pattern table tile low
-                     *     - Pattern table tile high ("+8 bytes from patter table tile low")
-                     *
-                     * Every 8 cycles, this data is loaded to the appropriate shift registers.
-                     * This also means each 8 sequential pixels must have the same palette attribute
-                     *
-                     * Sprite 0 hit acts as if image starts on cycle 2 (same 
-                     * cycle shift register shifts for first time), and so 
-                     * sprite 0 flag raised on cycle 2 at the earliest. Due 
-                     * to render pipelining, first pixel is output on cycle 4.
-                     *
-                     * Then, shifters are reloaded on cycles 9, 17, 25, ..., 257.
-                     * 
-                     * Also, sprite evaluation for next scanline occurs parallel/independant to these cycles
-                     * 
-                     */
-
-                    if(dot == 2){
-                        // sprite 0 hit
-                    }
+    if((ppu_mask & 0x18) != 0x18 || top > 239){
+        return Scheduler::NEVER;
+    }
 
-                    if(dot >= 9 && (dot % 8) == 1){
-                        // reload shift registers every 8 cycles
-                    }
+    if(!(ppu_status & 0x40) && scanline <= 239){
+        if(line_mode == SCANLINE && sprite0_hit_dot >= 0 
+                && (scanline < sprite0_hit_line || (scanline == sprite0_hit_line && dot <= sprite0_hit_dot))){
+            return timestamp + dots_until(sprite0_hit_line, sprite0_hit_dot) * Scheduler::PPU_CLOCK_DIVIDER;
+        }
 
-                    dot_modulo = ((dot-1) % 8) + 1; // dot mod 8, rolling over to 1 instead of 0
-                    switch(dot_modulo){ 
-                        case 1 ... 2:
-                            // nametable byte
-                            break;
+        const int window_line = (dot > 321) ? scanline + 1 : scanline; // line whose fetch window the PPU is in
+        if(line_mode == DOT && window_line >= top && window_line < bottom && in_fetch_window()){
+            return timestamp + Scheduler::PPU_CLOCK_DIVIDER;
+        }
 
-                        case 3 ... 4:
-                            // attribute byte
-                            break;
+        // first line whose fetch window hasn't started yet
+        int line = std::max((dot <= 321) ? scanline + 1 : scanline + 2, top);
+        if(line < bottom && line <= 239){
+            return timestamp + dots_until(line - 1, 321) * Scheduler::PPU_CLOCK_DIVIDER;
+        }
+    }
 
-                        case 5 ... 6:
-                            // pattern table tile low byte
-                            break;
+    // nothing left to hit this frame, wait for the next one
+    return timestamp + dots_until(top - 1, 321) * Scheduler::PPU_CLOCK_DIVIDER;
+}
 
-                        case 7 ... 8:
-                            // pattern table tile high byte
-                            break;
+// Sprite overflow is set when the sprites of a line with more than 8 are
+// evaluated, on dot 257 of the line before, see evaluate_sprites()
+uint64_t PPU::next_overflow_time(){
+    if(!rendering_enabled() || (ppu_status & 0x20)){
+        return Scheduler::NEVER;
+    }
+    if(sprite_lists_stale){
+        update_sprite_lists();
+    }
 
-                        default:
-                            VNES_LOG::LOG(VNES_LOG::ERROR, "PPU reached bad memory fetch: tried to do memory fetch for cycle %d: cycle %d, scanline %d", dot, dot, scanline);
-                            break;
+    // first line whose sprites haven't been evaluated yet, then the lines
+    // of the next frame
+    const int first = std::max((dot <= 257) ? scanline + 1 : scanline + 2, 0);
+    for(int line = first; line <= 239; line++){
+        if(sprite_list_overflow[line]){
+            return timestamp + dots_until(line - 1, 257) * Scheduler::PPU_CLOCK_DIVIDER;
+        }
+    }
+    for(int line = 0; line < std::min(first, 240); line++){
+        if(sprite_list_overflow[line]){
+            return timestamp + dots_until(line - 1, 257) * Scheduler::PPU_CLOCK_DIVIDER;
+        }
+    }
+    return Scheduler::NEVER;
+}
 
+/*
+ * Each kind of line splits into the same phases (see
+ * https://www.nesdev.org/wiki/PPU_rendering):
+ *     0         idle
+ *     1-256     visible fetch: tiles for this line, 8 dots each (nametable,
+ *               attribute, pattern low, pattern high), pixels output
+ *     257-320   sprite fetch: patterns of the sprites on the next line
+ *     321-336   prefetch: the first two tiles of the next line
+ *     337-340   idle, two unused nametable fetches
+ * The post-render line and the vblank lines fetch nothing. In SCANLINE mode
+ * all of it happens on a handful of dots at the ends of the phases, so each
+ * kind of line has a table of the next dot, from every dot, where anything
+ * happens, and run_until() jumps straight over the dots in between. With
+ * rendering disabled in PPU_MASK the fetch phases drop out of the tables,
+ * leaving the dot the backdrop is drawn on.
+ */
+PPU::PhaseTables PPU::build_phase_tables(){
+    PhaseTables tables;
+    for(int kind = 0; kind < LINE_KINDS; kind++){
+        for(int enabled = 0; enabled < 2; enabled++){
+            bool busy[DOTS_PER_LINE] = {};
+            if(kind == PRE_RENDER_LINE){
+                busy[0] = true; // the frame skip is latched
+                busy[1] = true; // vblank ends, the first fetch window starts
+                if(enabled){
+                    for(int dot = 280; dot <= 304; dot++){
+                        busy[dot] = true; // vertical bits of t to v
                     }
+                }
+            }
+            if(kind == PRE_RENDER_LINE || kind == VISIBLE_LINE){
+                busy[321] = true; // prefetch, the next line is drawn
+                if(enabled){
+                    busy[256] = true; // end of the visible fetch
+                    busy[257] = true; // sprite fetch
+                    busy[336] = true; // end of the prefetch
+                }
+            }
+            if(kind == VBLANK_START_LINE){
+                busy[1] = true; // vblank starts
+            }
 
-                    break;
+            int next = DOTS_PER_LINE;
+            for(int dot = DOTS_PER_LINE - 1; dot >= 0; dot--){
+                if(busy[dot]){
+                    next = dot;
+                }
+                tables.next_busy_dot[kind][enabled][dot] = next;
+            }
+        }
+    }
+    return tables;
+}
 
-                case 257 ... 320:
-                    // fetch sprite tile data for next scanline
-
-                    /*
-                     * Need to do the same 4 accesses as scanlines 0-256 for each of the 8 sprites:
-                     *     - Garbage nametable byte
-                     *     - Garbage attribute byte
-                     *     - Pattern table tile low
-                     *     - Pattern table tile high ("+8 bytes from patter table tile low")
-                     *
-                     */
-                    break;
+const PPU::PhaseTables PPU::PHASE_TABLES = PPU::build_phase_tables();
 
-                case 321 ... 336:
-                    // fetch first two tiles for next scanline and load into shift registers
-                    break;
+PPU::LineKind PPU::line_kind(int scanline){
+    if(scanline <= 239){
+        return (scanline == -1) ? PRE_RENDER_LINE : VISIBLE_LINE;
+    }
+    if(scanline == 240){
+        return POST_RENDER_LINE;
+    }
+    return (scanline == 241) ? VBLANK_START_LINE : VBLANK_LINE;
+}
 
-                case 337 ... 340:
-                    // fetch 2 unused bytes, both the same nametable as fetched 
-                    // at the start of the next scanline (MMC5 mapper uses this 
-                    // sequence to count scanlines)
-                    break;
+int PPU::line_length() const {
+    // scanline -1 skips dot 340 on odd frames and jumps to scanline 0, dot 0
+    return (odd_frame && scanline == -1) ? DOTS_PER_LINE - 1 : DOTS_PER_LINE;
+}
 
-                default:
-                    VNES_LOG::LOG(VNES_LOG::ERROR, "PPU reached bad dot: dot %d, scanline %d", dot, scanline);
-                    break;
-            }
+// The next dot on this line, from this one on, that cycle() has to run for,
+// or line_length() if there's none
+int PPU::next_busy_dot() const {
+    int next = PHASE_TABLES.next_busy_dot[line_kind(scanline)][rendering_enabled()][dot];
+    if(scanline == sprite0_hit_line && sprite0_hit_dot >= dot){
+        next = std::min(next, sprite0_hit_dot);
+    }
+    return std::min(next, line_length());
+}
 
-            if(odd_frame && scanline == -1 && dot == 339){
-                dot++; // scanline -1 skips dot 340 on odd frames and jumps to scanline 0, dot 0
-            }
-            
-            break;
+// Passes over dots where nothing happens, at most up to the end of the line
+void PPU::skip_dots(int count){
+    timestamp += (uint64_t)count * Scheduler::PPU_CLOCK_DIVIDER;
+    cycles_since_reset += count;
+    dot += count - 1;
+    advance_dot();
+}
+
+void PPU::step_dot(){
+    cycle();
+    timestamp += Scheduler::PPU_CLOCK_DIVIDER;
+    cycles_since_reset++;
+}
 
-        case 240:
-            // post-render line, idle scanline
+// Runs every dot between the last catch-up and target_timestamp. Nothing the
+// PPU does between register accesses is visible to the CPU until vblank, so
+// the CPU only calls this on register accesses, when the vblank event is
+// due and at the end of a frame.
+void PPU::run_until(uint64_t target_timestamp){
+    // the CPU catches the PPU up before every cartridge write, so a remap
+    // seen here applies from the dot of the write on. The replica is told
+    // about remaps in its log.
+    if(!replaying() && cart.chr_generation() != seen_chr_generation){
+        map_vram();
+    }
+    while(timestamp < target_timestamp){
+        if(line_mode == DOT && scanline <= 239){
+            step_dot(); // every dot of a line in dot mode does something
+            continue;
+        }
+
+        const uint64_t dots_left = (target_timestamp - timestamp + Scheduler::PPU_CLOCK_DIVIDER - 1) / Scheduler::PPU_CLOCK_DIVIDER;
+        const int busy = next_busy_dot();
+        if((uint64_t)(busy - dot) >= dots_left){
+            skip_dots(dots_left);
             break;
+        }
+        const bool busy_on_this_line = busy < line_length();
+        skip_dots(busy - dot);
+        if(busy_on_this_line){
+            step_dot();
+        }
+    }
+    schedule_vblank();
+    schedule_status();
+}
 
-        case 241 ... 260:
-            // vertical blanking lines
+void PPU::cycle(){
+    switch(line_kind(scanline)){
+        case PRE_RENDER_LINE:
+            // behaves like the visible lines, loading the shift registers
+            // for line 0, but outputs nothing
+            if(dot == 0){
+                skipping_frame = render_skip;
+            }else if(dot == 1){
+                // end of vblank: clear vblank, sprite 0 hit and sprite overflow
+                ppu_status &= 0x1F;
+                sprite0_hit_dot = -1;
+                line_mode = SCANLINE; // the first fetch window starts
+            }
+            [[fallthrough]];
 
-            if(scanline == 241 && dot == 1){
-                // set vblank flag and attempt to raise NMI
+        case VISIBLE_LINE:
+            if(dot == 321){
+                line_mode = SCANLINE; // a new fetch window starts on this dot
+            }
+            if(line_mode == DOT){
+                render_dot();
+            }else{
+                render_scanline_dot();
             }
             break;
 
-        //case 261:
-        //    // pre-render line (aka scanline -1)
-        //    break;
+        case VBLANK_START_LINE:
+            if(dot == 1){
+                // set vblank flag and attempt to raise NMI
+                ppu_status |= 0x80;
+                if(ppu_ctrl & 0x80){
+                    scheduler.raise_nmi();
+                }
+#if defined(VNES_RENDER_THREAD)
+                if(renders_on_thread()){
+                    hand_off_frame(); // all visible lines are done
+                }
+#endif
+            }
+            break;
 
         default:
-            VNES_LOG::LOG(VNES_LOG::ERROR, "PPU reached bad scanline: dot %d, scanline %d", dot, scanline);
-            break;
+            break; // post-render and vblank lines are idle
     }
 
+    advance_dot();
+}
+
+void PPU::advance_dot(){
     dot++;
-    if(dot > 340){
-        scanline++;
+    if(dot >= line_length()){
         dot = 0;
+        scanline = (scanline == 260) ? -1 : scanline + 1;
     }
-    
-    if(scanline > 260){
-        scanline = -1;
+}
+
+/* render thread, see RenderEvent */
+#if defined(VNES_RENDER_THREAD)
+
+PPU::~PPU(){
+    if(!renders_on_thread()){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(render_mutex);
+        render_quit = true;
     }
+    render_wake.notify_one();
+    render_thread.join();
+}
 
+void PPU::log_render_event(RenderEvent::Type type, uint16_t addr, uint8_t data, const uint8_t* payload, size_t payload_size){
+    RenderLog& log = render_logs[filling_log];
+    log.events.push_back(RenderEvent{timestamp, (uint32_t)log.payload.size(), addr, data, type});
+    log.payload.insert(log.payload.end(), payload, payload + payload_size);
 }
 
+// Copies the 12 pages of pattern tables and nametables as they are mapped
+// right now. The first 12 bytes say which earlier page each one is the same
+// memory as (itself if none), so the replica keeps the mirroring.
+void PPU::log_mapped_pages(){
+    uint8_t snapshot[12 + 12 * 0x400];
+    for(int page = 0; page < 12; page++){
+        snapshot[page] = page;
+        for(int earlier = 0; earlier < page; earlier++){
+            if(vram_pages[earlier] == vram_pages[page]){
+                snapshot[page] = earlier;
+                break;
+            }
+        }
+        memcpy(&snapshot[12 + page * 0x400], vram_pages[page], 0x400);
+    }
+    log_render_event(RenderEvent::MAP_PAGES, 0, 0, snapshot, sizeof(snapshot));
+}
+
+void PPU::map_replayed_pages(const uint8_t* snapshot){
+    for(int page = 0; page < 12; page++){
+        memcpy(replayed_pages[page], &snapshot[12 + page * 0x400], 0x400);
+        vram_pages[page] = replayed_pages[snapshot[page]];
+    }
+    for(int table = 0; table < 4; table++){
+        vram_pages[12 + table] = vram_pages[8 + table];
+    }
+    std::fill(std::begin(tile_valid), std::end(tile_valid), false);
+    invalidate_whole_bitmap();
+}
+
+// Called at the start of vblank. Waits for the render thread to finish the
+// frame before, takes its pixels and gives it the frame that just ended.
+void PPU::hand_off_frame(){
+    std::unique_lock<std::mutex> lock(render_mutex);
+    render_done.wait(lock, [this]{ return !render_busy; });
+
+    memcpy(buffer, replica->buffer, sizeof(buffer));
+    memcpy(indexed_buffer, replica->indexed_buffer, sizeof(indexed_buffer));
+    memcpy(indexed_variant, replica->indexed_variant, sizeof(indexed_variant));
+    replica->output_mode = output_mode; // the frontend may have changed these
+    replica->render_skip = render_skip;
+    memcpy(replica->colour_table, colour_table, sizeof(colour_table));
+
+    render_logs[filling_log].end_timestamp = timestamp;
+    filling_log ^= 1;
+    render_logs[filling_log].events.clear();
+    render_logs[filling_log].payload.clear();
+    render_busy = true;
+    lock.unlock();
+    render_wake.notify_one();
+}
+
+void PPU::render_thread_main(){
+    std::unique_lock<std::mutex> lock(render_mutex);
+    while(true){
+        render_wake.wait(lock, [this]{ return render_busy || render_quit; });
+        if(render_quit){
+            return;
+        }
+        const RenderLog& log = render_logs[filling_log ^ 1];
+        lock.unlock();
+        replica->replay(log);
+        lock.lock();
+        render_busy = false;
+        render_done.notify_one();
+    }
+}
+
+// Runs the replica through a frame's log. Each event is played back once
+// the replica has caught up to the timestamp it happened at.
+void PPU::replay(const RenderLog& log){
+    for(const RenderEvent& event : log.events){
+        run_until(event.timestamp);
+        switch(event.type){
+            case RenderEvent::REGISTER_WRITE:
+                replay_dma_page = log.payload.data() + event.payload; // only read by OAM DMA
+                register_write(event.addr, event.data);
+                replay_dma_page = nullptr;
+                break;
+            case RenderEvent::REGISTER_READ:
+                register_read(event.addr);
+                break;
+            case RenderEvent::MAP_PAGES:
+                map_replayed_pages(&log.payload[event.payload]);
+                break;
+            case RenderEvent::RESET:
+                reset();
+                break;
+        }
+    }
+    run_until(log.end_timestamp);
+}
+
+#endif
+
 /*
 void PPU::cycle(){
     cycles_since_reset++;
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "include/PixelKernels.hpp"
+#include "../common/log.hpp"
+#if defined(__x86_64__) && !defined(VNES_NO_SIMD)
+#include <immintrin.h>
+#endif
+
+PixelKernels::PixelKernels(){
+    decode_tile = decode_tile_scalar;
+    compose = compose_scalar;
+    map_colours = map_colours_scalar;
+    name = "scalar";
+#if defined(__x86_64__) && !defined(VNES_NO_SIMD)
+    decode_tile = decode_tile_sse2;
+    compose = compose_sse2;
+    name = "SSE2";
+    if(__builtin_cpu_supports("avx2")){
+        compose = compose_avx2;
+        map_colours = map_colours_avx2; // SSE2 has no gather, so there's no SSE2 version of this one
+        name = "AVX2";
+    }
+#endif
+    VNES_LOG::LOG(VNES_LOG::INFO, "Using %s pixel kernels", name);
+}
+
+void PixelKernels::decode_tile_scalar(const uint8_t* planes, uint8_t* normal, uint8_t* flipped){
+    for(int row = 0; row < 8; row++){
+        const uint8_t lo = planes[row];
+        const uint8_t hi = planes[row + 8];
+        for(int col = 0; col < 8; col++){
+            const uint8_t pixel = (((hi >> (7 - col)) & 0x01) << 1) | ((lo >> (7 - col)) & 0x01);
+            normal[row * 8 + col] = pixel;
+            flipped[row * 8 + 7 - col] = pixel;
+        }
+    }
+}
+
+void PixelKernels::compose_scalar(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count){
+    for(int i = 0; i < count; i++){
+        const uint8_t bg = (background[i] & 0x03) ? background[i] : 0;
+        const uint8_t sprite = sprites[i];
+        if((sprite & 0x03) && !(bg && (sprite & SPRITE_BEHIND))){
+            out[i] = sprite & 0x1F;
+        }else{
+            out[i] = bg;
+        }
+    }
+}
+
+void PixelKernels::map_colours_scalar(const uint8_t* indices, const uint32_t* colours, uint32_t* out, int count){
+    for(int i = 0; i < count; i++){
+        out[i] = colours[indices[i]];
+    }
+}
+
+#if defined(__x86_64__) && !defined(VNES_NO_SIMD)
+
+// Each plane byte is copied into 8 lanes, one per pixel, then each lane
+// tests its own bit. That does two rows per 16 byte vector.
+void PixelKernels::decode_tile_sse2(const uint8_t* planes, uint8_t* normal, uint8_t* flipped){
+    const __m128i left_to_right = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i right_to_left = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+
+    __m128i lo = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes));
+    __m128i hi = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(planes + 8));
+    lo = _mm_unpacklo_epi8(lo, lo);
+    hi = _mm_unpacklo_epi8(hi, hi);
+    const __m128i lo_quads[2] = {_mm_unpacklo_epi16(lo, lo), _mm_unpackhi_epi16(lo, lo)};
+    const __m128i hi_quads[2] = {_mm_unpacklo_epi16(hi, hi), _mm_unpackhi_epi16(hi, hi)};
+
+    for(int pair = 0; pair < 4; pair++){
+        const __m128i lo_rows = (pair & 1) ? _mm_unpackhi_epi32(lo_quads[pair >> 1], lo_quads[pair >> 1])
+                                           : _mm_unpacklo_epi32(lo_quads[pair >> 1], lo_quads[pair >> 1]);
+        const __m128i hi_rows = (pair & 1) ? _mm_unpackhi_epi32(hi_quads[pair >> 1], hi_quads[pair >> 1])
+                                           : _mm_unpacklo_epi32(hi_quads[pair >> 1], hi_quads[pair >> 1]);
+
+        __m128i pixels = _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo_rows, left_to_right), left_to_right), one),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi_rows, left_to_right), left_to_right), two));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(normal + pair * 16), pixels);
+
+        pixels = _mm_or_si128(
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(lo_rows, right_to_left), right_to_left), one),
+                _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(hi_rows, right_to_left), right_to_left), two));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(flipped + pair * 16), pixels);
+    }
+}
+
+void PixelKernels::compose_sse2(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count){
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i pattern_bits = _mm_set1_epi8(0x03);
+    const __m128i behind_bit = _mm_set1_epi8(SPRITE_BEHIND);
+    const __m128i index_bits = _mm_set1_epi8(0x1F);
+    for(int i = 0; i < count; i += 16){
+        const __m128i bg = _mm_loadu_si128(reinterpret_cast<const __m128i*>(background + i));
+        const __m128i sprite = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sprites + i));
+
+        const __m128i bg_transparent = _mm_cmpeq_epi8(_mm_and_si128(bg, pattern_bits), zero);
+        const __m128i sprite_transparent = _mm_cmpeq_epi8(_mm_and_si128(sprite, pattern_bits), zero);
+        const __m128i behind = _mm_cmpeq_epi8(_mm_and_si128(sprite, behind_bit), behind_bit);
+        // the sprite loses where it's transparent, or behind an opaque background
+        const __m128i sprite_loses = _mm_or_si128(sprite_transparent, _mm_andnot_si128(bg_transparent, behind));
+
+        const __m128i bg_pixel = _mm_andnot_si128(bg_transparent, bg);
+        const __m128i sprite_pixel = _mm_andnot_si128(sprite_loses, _mm_and_si128(sprite, index_bits));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_or_si128(sprite_pixel, _mm_and_si128(sprite_loses, bg_pixel)));
+    }
+}
+
+__attribute__((target("avx2")))
+void PixelKernels::compose_avx2(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count){
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i pattern_bits = _mm256_set1_epi8(0x03);
+    const __m256i behind_bit = _mm256_set1_epi8(SPRITE_BEHIND);
+    const __m256i index_bits = _mm256_set1_epi8(0x1F);
+    for(int i = 0; i < count; i += 32){
+        const __m256i bg = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(background + i));
+        const __m256i sprite = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sprites + i));
+
+        const __m256i bg_transparent = _mm256_cmpeq_epi8(_mm256_and_si256(bg, pattern_bits), zero);
+        const __m256i sprite_transparent = _mm256_cmpeq_epi8(_mm256_and_si256(sprite, pattern_bits), zero);
+        const __m256i behind = _mm256_cmpeq_epi8(_mm256_and_si256(sprite, behind_bit), behind_bit);
+        const __m256i sprite_loses = _mm256_or_si256(sprite_transparent, _mm256_andnot_si256(bg_transparent, behind));
+
+        const __m256i bg_pixel = _mm256_andnot_si256(bg_transparent, bg);
+        const __m256i sprite_pixel = _mm256_andnot_si256(sprite_loses, _mm256_and_si256(sprite, index_bits));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_or_si256(sprite_pixel, _mm256_and_si256(sprite_loses, bg_pixel)));
+    }
+}
+
+__attribute__((target("avx2")))
+void PixelKernels::map_colours_avx2(const uint8_t* indices, const uint32_t* colours, uint32_t* out, int count){
+    for(int i = 0; i < count; i += 8){
+        const __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i)));
+        const __m256i colour = _mm256_i32gather_epi32(reinterpret_cast<const int*>(colours), index, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), colour);
+    }
+}
+
+#endif
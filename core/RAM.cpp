@@ -20,7 +20,6 @@ RAM::RAM(Cartridge& _cart, Controller& _controller): cart {_cart}, controller {_
 
 void RAM::write(uint16_t addr, uint8_t data){
     using namespace VNES_LOG;
-    if(addr <= 0x2000 && addr % 0x0800 == 0x0180) { printf("RAM.write(): addr 0x%x mirrors or is 0x0180, data is 0x%x\n", addr, data); }
     switch(addr){
         case 0x0000 ... 0x1FFF: // 2kb program RAM, 4 mirrored sections (each 0x0800 addrs)
             ram[(addr % 0x0800)] = data;
@@ -84,10 +83,31 @@ uint8_t RAM::read(uint16_t addr){
             break;
     }
     LOG(DEBUG, "Read value 0x%x from address 0x%x", data, addr);
-    if(addr <= 0x2000 && addr % 0x0800 == 0x0180) { printf("RAM.read(): addr 0x%x mirrors or is 0x0180, data is 0x%x\n", addr, data); }
     return data;
 }
 
+uint8_t* RAM::read_page(uint8_t page){
+    switch(page){
+        case 0x00 ... 0x1F: // 2kb program RAM, 4 mirrored sections (each 0x0800 addrs)
+            return &ram[(page << 8) % 0x0800];
+        case 0x60 ... 0xFF: // cartridge RAM and ROM
+            return cart.prg_page(page, false);
+        default:
+            return nullptr;
+    }
+}
+
+uint8_t* RAM::write_page(uint8_t page){
+    switch(page){
+        case 0x00 ... 0x1F:
+            return &ram[(page << 8) % 0x0800];
+        case 0x60 ... 0xFF:
+            return cart.prg_page(page, true);
+        default:
+            return nullptr;
+    }
+}
+
 void RAM::dump(){
     VNES_LOG::LOG(VNES_LOG::INFO, "Dumping RAM as accessed by RAM::read() (not resilient to cartridge/mapper/RAM bugs)");
     FILE* file = fopen("ram.dump", "w");
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "include/Scheduler.hpp"
+#include <algorithm>
+
+Scheduler::Scheduler(){
+    event_time.fill(NEVER);
+    next_time = NEVER;
+    nmi_latched = false;
+    irq_lines = 0;
+    cpu_stall = 0;
+}
+
+void Scheduler::schedule(Event event, uint64_t timestamp){
+    event_time[event] = timestamp;
+    update_next_time();
+}
+
+void Scheduler::cancel(Event event){
+    event_time[event] = NEVER;
+    update_next_time();
+}
+
+// there are only a handful of events, so a linear scan beats keeping a heap
+void Scheduler::update_next_time(){
+    next_time = *std::min_element(event_time.begin(), event_time.end());
+}
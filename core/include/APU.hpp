@@ -1,8 +1,44 @@
 #pragma once
 
+#include <stdint.h>
+#include "RAM.hpp"
+#include "Scheduler.hpp"
+#include "../BlipBuffer.cpp"
+
+/*
+ * The 2A03's sound generator: two pulse channels, a triangle, noise, the
+ * delta modulation channel (DMC) and the frame counter that clocks their
+ * envelopes, sweeps and length counters. Like the PPU it runs behind the
+ * CPU and is caught up to the CPU's timestamp when the CPU touches its
+ * registers, when one of its IRQs is due and at the end of a frame, when
+ * the frame's audio is collected. Catching up skips straight over the
+ * cycles where nothing can change, see run_until().
+ *
+ * The channels are never turned into samples at the CPU clock. Whenever
+ * the mixed output changes, the change is added to a BlipBuffer at the
+ * cycle it happened on, and the samples are built from those steps when a
+ * frame ends.
+ */
 class APU{
     public:
-        // see https://www.nesdev.org/wiki/APU#Registers 
+        APU(RAM& _ram, Scheduler& _scheduler);
+        void power_up();
+        void reset();
+        void run_until(uint64_t target_timestamp); // catches up to a master clock timestamp
+
+        void register_write(uint16_t addr, uint8_t data);
+        uint8_t register_read(uint16_t addr);
+
+        // NTSC CPU clock, 21.477272 MHz / 12
+        static constexpr double CPU_CLOCK_RATE = 21477272.0 / Scheduler::CPU_CLOCK_DIVIDER;
+        static constexpr int SAMPLE_RATE = 44100;
+
+        // makes the audio up to where the APU has caught up to readable
+        void end_frame();
+        int samples_available() const { return blip.samples_available(); }
+        int read_samples(int16_t* out, int count){ return blip.read_samples(out, count); }
+
+        // see https://www.nesdev.org/wiki/APU#Registers
         // UNUSED ADDRESSES: 0x4009, 0x400D, 0x4014
         enum APU_regs{
                 SQ1_VOL    = 0x4000, 	 // ddlcvvvv 	Square wave 1, duty and volume
@@ -29,4 +65,143 @@ class APU{
         };
 
     private:
+        RAM& ram; // the DMC reads its samples straight from memory
+        Scheduler& scheduler;
+
+        uint64_t timestamp;  // master clock time the APU has caught up to
+        uint32_t frame_time; // CPU cycles since the last end_frame()
+        BlipBuffer blip {CPU_CLOCK_RATE, SAMPLE_RATE};
+
+        /* channel building blocks */
+        // All timers count CPU cycles: counter is the number of cycles
+        // until the timer next clocks its channel, counting that cycle.
+        struct Envelope{
+            bool start;
+            bool loop;     // also halts the length counter
+            bool constant;
+            uint8_t volume; // constant volume, or the divider period
+            uint8_t divider;
+            uint8_t decay;
+
+            void clock();
+            uint8_t output() const { return constant ? volume : decay; }
+        };
+
+        struct Pulse{
+            Envelope envelope;
+            uint8_t duty;
+            uint8_t sequence_step;
+            uint16_t period; // 11 bits, the timer clocks every 2 * (period + 1) cycles
+            uint32_t counter;
+            bool enabled; // in SND_CHN, lengths only load while it is set
+            uint8_t length;
+
+            bool sweep_enabled;
+            bool sweep_negate;
+            bool sweep_reload;
+            uint8_t sweep_period;
+            uint8_t sweep_shift;
+            uint8_t sweep_divider;
+            bool ones_complement; // pulse 1 negates with one's complement
+
+            uint16_t sweep_target() const;
+            bool muted() const { return period < 8 || sweep_target() > 0x7FF; }
+            void clock_sweep();
+            uint8_t output() const;
+        };
+
+        struct Triangle{
+            bool control; // also halts the length counter
+            uint8_t linear_reload_value;
+            uint8_t linear_counter;
+            bool linear_reload;
+            uint8_t sequence_step;
+            uint16_t period; // the timer clocks every period + 1 cycles
+            uint32_t counter;
+            bool enabled;
+            uint8_t length;
+
+            // periods below 2 are ultrasonic, and only make a pop when the
+            // triangle stops, so those hold the triangle where it is instead
+            bool steps() const { return length && linear_counter && period >= 2; }
+            uint8_t output() const;
+        };
+
+        struct Noise{
+            Envelope envelope;
+            bool short_mode;
+            uint16_t period;
+            uint32_t counter;
+            uint16_t shift_register; // 15 bits
+            bool enabled;
+            uint8_t length;
+
+            uint8_t output() const { return (length && !(shift_register & 0x01)) ? envelope.output() : 0; }
+        };
+
+        struct DMC{
+            bool irq_enabled;
+            bool loop;
+            uint16_t period;
+            uint32_t counter;
+            uint8_t level; // 7 bits
+
+            uint16_t sample_address;
+            uint16_t sample_length;
+            uint16_t address;         // of the next byte to fetch
+            uint16_t bytes_remaining;
+            uint8_t buffer;
+            bool buffer_full;
+
+            uint8_t shift_register;
+            uint8_t bits_remaining;
+            bool silence;
+        };
+
+        Pulse pulse[2];
+        Triangle triangle;
+        Noise noise;
+        DMC dmc;
+
+        /* frame counter */
+        bool five_step_mode;
+        bool frame_irq_inhibit;
+        bool frame_irq;
+        bool dmc_irq;
+        int frame_step_cycle; // CPU cycles into the sequence, negative while a write to $4017 takes effect
+
+        static constexpr int QUARTER_FRAME_CYCLES[4] = {7457, 14913, 22371, 29829};
+        static constexpr int FIVE_STEP_LAST_CYCLE = 37281;
+        int sequence_length() const { return five_step_mode ? FIVE_STEP_LAST_CYCLE + 1 : QUARTER_FRAME_CYCLES[3] + 1; }
+
+        /* mixer */
+        // the output is two non-linear mixes, of the pulses and of the rest
+        float pulse_table[31];  // [pulse 1 + pulse 2]
+        float tnd_table[203];   // [3 * triangle + 2 * noise + dmc]
+        float mixed_output;
+
+        static const uint8_t LENGTH_TABLE[32];
+        static const uint8_t DUTY_TABLE[4][8];
+        static const uint8_t TRIANGLE_SEQUENCE[32];
+        static const uint16_t NOISE_PERIODS[16];
+        static const uint16_t DMC_PERIODS[16];
+
+        uint32_t cycles_until_change() const;
+        void skip(uint32_t cycles);
+        static uint32_t advance_timer(uint32_t& counter, uint32_t period, uint32_t cycles);
+        void clock();
+        void clock_frame_counter();
+        void clock_quarter_frame();
+        void clock_half_frame();
+        void clock_noise_shift_register();
+        void clock_dmc();
+        void fetch_dmc_sample();
+        void restart_dmc_sample();
+        void update_output();
+        void update_irq();
+        void schedule_irq();
+        int cycles_until_frame_irq() const;
+        int cycles_until_frame_cycle(int cycle) const;
+        uint32_t cycles_until_frame_step() const;
+        int cycles_until_dmc_irq() const;
 };
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+/*
+ * Turns a waveform given as steps, the amplitude changing by some delta at
+ * some clock, into samples at the output rate without ever generating it
+ * at the clock rate. Each step is added as a band-limited step: its delta
+ * is spread over KERNEL_WIDTH samples by a windowed sinc, picked from
+ * PHASES of them by where the step falls between two samples, and the
+ * samples sum the deltas back up when they're read. Nothing above the
+ * output's Nyquist frequency gets in, so square waves don't alias, and
+ * clocks where the waveform holds still cost nothing.
+ */
+class BlipBuffer{
+    public:
+        BlipBuffer(double clock_rate, int sample_rate);
+
+        // time is in clocks since the last end_frame()
+        void add_delta(uint32_t time, float delta);
+        // ends a frame that many clocks long, its samples can then be read
+        void end_frame(uint32_t time);
+        void clear();
+
+        int samples_available() const { return available; }
+        int read_samples(int16_t* out, int count); // returns how many were read
+
+        const int sample_rate;
+
+    private:
+        static constexpr int KERNEL_WIDTH = 16;
+        static constexpr int PHASE_BITS = 5;
+        static constexpr int PHASES = 1 << PHASE_BITS;
+        static constexpr int FRAC_BITS = 32; // of positions in samples
+
+        float kernel[PHASES][KERNEL_WIDTH];
+
+        uint64_t samples_per_clock; // fixed point, FRAC_BITS
+        uint64_t frame_start;       // position of the current frame, fixed point, from the first unread sample
+        std::vector<float> deltas;  // from the first unread sample on
+        int available;
+
+        // the running sum of the deltas, and a high-pass that takes the DC
+        // offset out of it like the capacitors on the audio output
+        float level;
+        float highpass_in;
+        float highpass_out;
+        float highpass_factor;
+};
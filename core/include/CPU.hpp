@@ -3,8 +3,14 @@
 #include <stdint.h>
 #include "../RAM.cpp"
 #include "../PPU.cpp"
+#include "../APU.cpp"
 #include "../../common/typedefs.hpp"
 #include <string>
+#include <array>
+#include <vector>
+#if defined(VNES_JIT)
+#include "JIT.hpp"
+#endif
 
 
 // The NES CPU is a modified version of the MOS 6502 called the Ricoh 2A03.
@@ -13,14 +19,20 @@
 // TODO: clean up switching between public and private
 class CPU{
     public:
-        CPU(RAM& _ram, PPU& ppu_);
+        CPU(RAM& _ram, PPU& ppu_, Scheduler& _scheduler);
         void step();
-        const bool MASKABLE_IRQ = false; // interrupts are not actually maskable, since implementing masking is hard and im dumb
+        uint64_t run_until(uint64_t cycle_deadline); // runs until frame_cycles reaches the deadline
+        uint64_t run_frame(); // runs one frame, frame_cycles restarts from 0 (plus overshoot)
         void reset();
 
     //private:
         RAM& ram;
         PPU& ppu;
+        Scheduler& scheduler;
+        APU apu {ram, scheduler}; // the 2A03 has the APU on the same chip
+#if defined(VNES_JIT)
+        JIT jit {ram};
+#endif
 
         /* registers */
         uint16_t program_counter;
@@ -36,22 +48,55 @@ class CPU{
          * CPU side effects (see https://www.nesdev.org/wiki/Status_flags#The_B_flag)
          */
         bit carry_f;
-        bit zero_f;
         bit interrupt_disable_f;
         bit b_flag_f;
         bit decimal_f;
         bit overflow_f;
-        bit negative_f;
+
+        /* N and Z are not stored, they are derived from the last result on
+         * demand. Nearly every instruction changes them but only branches,
+         * PHP and interrupts ever look at them. The low byte is the result
+         * (Z is set when it is 0) and bit 7 or bit 8 gives N, so that BIT
+         * and PLP can still hold N and Z both set.
+         */
+        uint16_t nz_result;
+        void set_nz(uint8_t result){ nz_result = result; }
+        bool zero_f() const { return (uint8_t)nz_result == 0; }
+        bool negative_f() const { return nz_result & 0b110000000; }
     public: 
         uint8_t status_as_int(); // returns the packed status register
         void    set_status_reg(uint8_t data); 
 
         uint64_t cycles_since_reset;
         uint64_t frame_cycles;
+        uint64_t frame_start_cycle; // CPU cycles from power up to the start of the current frame
+
+        // master clock time of the CPU, see Scheduler
+        uint64_t timestamp() const { return (frame_start_cycle + frame_cycles) * Scheduler::CPU_CLOCK_DIVIDER; }
+
+        // NTSC: 341 dots * 262 scanlines / 3 dots per CPU cycle
+        static constexpr uint64_t CYCLES_PER_FRAME = 29781;
 
     private:
-        uint8_t fetch_instruction();
-        int     execute_instruction(uint8_t instruction);
+        void    retire_instruction(uint8_t opcode, int cycles_done);
+        void    trace_instruction(uint8_t opcode);
+        bool    tracing();
+        uint64_t run_interpreter(bool trace);
+        uint64_t next_event_cycle();
+        void    service_events();
+        void    poll_interrupts();
+        void    end_slice();
+
+        // frame_cycles at which the run loops stop and return to run_until(),
+        // which is the batch deadline or the next event, whichever is first
+        uint64_t slice_deadline;
+#if defined(VNES_THREADED_CORE)
+        uint64_t run_threaded(bool trace);
+#endif
+#if defined(VNES_JIT)
+        uint64_t run_jit(bool trace);
+        uint64_t run_block(JIT::Block& block);
+#endif
 
         // see https://www.masswerk.at/6502/6502_instruction_set.html#ADC
         enum ADDRESSING_MODE{
@@ -70,13 +115,126 @@ class CPU{
             ZPGY        // Zeropage, Y-indexed
         };
 
-        typedef     std::vector<enum ADDRESSING_MODE> AddrModeVec;
-        uint16_t    fetch_address(enum ADDRESSING_MODE mode, const AddrModeVec& page_crossing_modes);
-        void        add_cycle_if_page_crossed(uint16_t base_addr, uint16_t offset, CPU::ADDRESSING_MODE mode, const AddrModeVec& modes);
+        // whether an indexed access that crosses a page costs an extra cycle
+        enum PAGE_CROSSING{
+            IGNORE_PAGE_CROSS,          // stores and read-modify-write instructions
+            ADD_CYCLE_ON_PAGE_CROSS     // instructions that only read their operand
+        };
+
+        template<enum ADDRESSING_MODE mode, enum PAGE_CROSSING page_crossing>
+        uint16_t    fetch_address();
+        void        add_cycle_if_page_crossed(uint16_t base_addr, uint16_t offset);
+
+        static constexpr uint8_t instruction_bytes(enum ADDRESSING_MODE mode);
+
+        /* opcode dispatch table */
+        /* Every opcode maps to one entry describing how to execute it. The
+         * table is built at compile time (see build_instruction_table()), so
+         * executing an instruction is a single indexed call instead of a
+         * switch over all 256 opcodes.
+         */
+    public:
+        struct Instruction{
+            void (CPU::*handler)();     // executes the instruction, including operand fetches
+            enum ADDRESSING_MODE mode;
+            uint8_t cycles;             // base cycle count, before page crossing/branch penalties
+            uint8_t bytes;              // instruction length, including the opcode byte
+            const char* name;           // OPCODE enum name, for tracing
+        };
+        static const std::array<Instruction, 256> instruction_table;
+    private:
+        static constexpr std::array<Instruction, 256> build_instruction_table();
+
+        /* decoded instruction cache */
+        /* Code in PRG-ROM is decoded once, after which fetching it is a
+         * single lookup instead of going through RAM, Cartridge and the
+         * mapper for the opcode and each operand byte. Entries are indexed by
+         * PC and tagged with decode_generation, which moves on whenever the
+         * cartridge's PRG generation changes (bank switch or ROM write), so
+         * entries are effectively keyed by (bank, PC) and a bank switch
+         * costs nothing up front. Code anywhere else (RAM, PRG-RAM) is
+         * decoded from the bus every time.
+         */
+        struct DecodedInstruction{
+            void (CPU::*handler)();
+            uint8_t opcode;
+            uint8_t operand_lo;
+            uint8_t operand_hi;
+            uint8_t cycles;
+            uint32_t generation;    // valid while it matches decode_generation
+        };
+        std::vector<DecodedInstruction> decode_cache; // one entry per address in 0x8000 - 0xFFFD
+        DecodedInstruction fetched; // current instruction when it isn't cached
+        uint32_t decode_generation;
+        uint32_t seen_prg_generation;
+
+        // operand bytes of the instruction being executed, read by fetch_address()
+        uint8_t operand_lo;
+        uint8_t operand_hi;
+
+        const DecodedInstruction& fetch_instruction();
+        void    decode_instruction(uint16_t addr, DecodedInstruction& decoded);
+        void    execute_instruction(const DecodedInstruction& decoded);
+
+        template<enum ADDRESSING_MODE mode, enum PAGE_CROSSING page_crossing>
+        uint8_t     fetch_operand();
+
+        /* idle loop detection */
+        /* Waiting for vblank or for the NMI handler to set a flag is nearly
+         * always a load and a branch spinning in place (LDA $2002 / BPL, or
+         * LDA flag / BEQ). The run loops report every backward branch, and
+         * once a loop like that has gone around once without changing any
+         * register or the value it polls, every iteration up to the next
+         * scheduled event would do the same. Those iterations are skipped by
+         * adding their cycles directly.
+         */
+        struct IdleState{
+            uint8_t accumulator;
+            uint8_t index_X;
+            uint8_t index_Y;
+            uint16_t nz_result;
+            bool carry_f;
+            bool overflow_f;
+            uint8_t polled;     // value at poll_addr, read without side effects
+            bool operator==(const IdleState&) const = default;
+        };
+        struct IdleLoop{
+            uint16_t head;              // address the loop branches back to
+            uint32_t generation;        // decode_generation of the analysis, 0 if there is none
+            bool     pollable;          // the body only reads poll_addr and branches back to head
+            uint8_t  instructions;      // instructions per iteration
+            uint16_t poll_addr;
+
+            // when head was last reached, valid if probed
+            bool     probed;
+            IdleState state;
+            uint64_t cycles;
+            uint64_t instructions_done;
+        };
+        IdleLoop idle_loop;
+        static constexpr int MAX_IDLE_LOOP_INSTRUCTIONS = 4;
+
+        void    analyse_idle_loop(uint16_t head);
+        IdleState idle_state();
+        void    skip_idle_loop(uint64_t& instructions_done);
     public:
         uint8_t     read_mem(uint16_t addr);
         void        write_mem(uint16_t addr, uint8_t data);
     private:
+        /* memory map */
+        /* The address space is split into 256 byte pages. Pages of plain
+         * memory (internal RAM and its mirrors, PRG-RAM, PRG-ROM) point
+         * straight at it, so most accesses are a lookup and a load. Pages
+         * holding registers are nullptr and go through read_mmio() and
+         * write_mmio(), as do writes to ROM. The pages are remapped whenever
+         * the cartridge's PRG generation changes.
+         */
+        std::array<uint8_t*, 0x100> read_pages;
+        std::array<uint8_t*, 0x100> write_pages;
+        void        map_pages();
+        uint8_t     read_mmio(uint16_t addr);
+        void        write_mmio(uint16_t addr, uint8_t data);
+
         void        push_stack(uint8_t data);
         uint8_t     pop_stack();
 
@@ -97,6 +255,7 @@ class CPU{
         uint16_t    read_brk_vec();
 
         void raise_interrupt(bool maskable, bool from_instruction);
+        static constexpr uint64_t INTERRUPT_CYCLES = 7; // NMI and IRQ take as long as BRK
         void return_from_interrupt();
 
 
@@ -413,12 +572,12 @@ class CPU{
     private:
         /* INSTRUCTIONS */
         /* Load/Store */
-        void LDA(enum ADDRESSING_MODE mode);    // Load Accumulator 	N,Z
-        void LDX(enum ADDRESSING_MODE mode); 	// Load X Register 	    N,Z
-        void LDY(enum ADDRESSING_MODE mode); 	// Load Y Register 	    N,Z
-        void STA(enum ADDRESSING_MODE mode); 	// Store Accumulator 	 
-        void STX(enum ADDRESSING_MODE mode); 	// Store X Register 	 
-        void STY(enum ADDRESSING_MODE mode);    // Store Y Register 	 
+        template<enum ADDRESSING_MODE mode> void LDA();    // Load Accumulator 	N,Z
+        template<enum ADDRESSING_MODE mode> void LDX(); 	// Load X Register 	    N,Z
+        template<enum ADDRESSING_MODE mode> void LDY(); 	// Load Y Register 	    N,Z
+        template<enum ADDRESSING_MODE mode> void STA(); 	// Store Accumulator 	 
+        template<enum ADDRESSING_MODE mode> void STX(); 	// Store X Register 	 
+        template<enum ADDRESSING_MODE mode> void STY();    // Store Y Register 	 
 
         /* Register Transfers */
         void TAX(); 	// Transfer accumulator to X 	N,Z - IMPLIED MODE ONLY
@@ -435,38 +594,38 @@ class CPU{
         void PLP(); 	// Pull processor status from stack All - IMPLIED MODE ONLY
 
         /* Logical */
-        void AND(enum ADDRESSING_MODE mode); 	// Logical AND 	            N,Z
-        void EOR(enum ADDRESSING_MODE mode); 	// Exclusive OR 	        N,Z
-        void ORA(enum ADDRESSING_MODE mode); 	// Logical Inclusive OR 	N,Z
-        void BIT(enum ADDRESSING_MODE mode); 	// Bit Test 	            N,V,Z
+        template<enum ADDRESSING_MODE mode> void AND(); 	// Logical AND 	            N,Z
+        template<enum ADDRESSING_MODE mode> void EOR(); 	// Exclusive OR 	        N,Z
+        template<enum ADDRESSING_MODE mode> void ORA(); 	// Logical Inclusive OR 	N,Z
+        template<enum ADDRESSING_MODE mode> void BIT(); 	// Bit Test 	            N,V,Z
 
         /* Arithmetic */
-        void ADC(enum ADDRESSING_MODE mode); 	// Add with Carry 	    N,V,Z,C 
-        void SBC(enum ADDRESSING_MODE mode); 	// Subtract with Carry 	N,V,Z,C
-        void CMP(enum ADDRESSING_MODE mode); 	// Compare accumulator 	N,Z,C
-        void CPX(enum ADDRESSING_MODE mode); 	// Compare X register 	N,Z,C
-        void CPY(enum ADDRESSING_MODE mode); 	// Compare Y register 	N,Z,C
+        template<enum ADDRESSING_MODE mode> void ADC(); 	// Add with Carry 	    N,V,Z,C 
+        template<enum ADDRESSING_MODE mode> void SBC(); 	// Subtract with Carry 	N,V,Z,C
+        template<enum ADDRESSING_MODE mode> void CMP(); 	// Compare accumulator 	N,Z,C
+        template<enum ADDRESSING_MODE mode> void CPX(); 	// Compare X register 	N,Z,C
+        template<enum ADDRESSING_MODE mode> void CPY(); 	// Compare Y register 	N,Z,C
 
         /* Increments & Decrements */
-        void INC(enum ADDRESSING_MODE mode); 	// Increment a memory location 	N,Z
+        template<enum ADDRESSING_MODE mode> void INC(); 	// Increment a memory location 	N,Z
         void INX(); 	                        // Increment the X register 	N,Z - IMPLIED MODE ONLY
         void INY(); 	                        // Increment the Y register 	N,Z - IMPLIED MODE ONLZ
-        void DEC(enum ADDRESSING_MODE mode); 	// Decrement a memory location 	N,Z
+        template<enum ADDRESSING_MODE mode> void DEC(); 	// Decrement a memory location 	N,Z
         void DEX(); 	                        // Decrement the X register 	N,Z - IMPLIED MODE ONLY
         void DEY(); 	                        // Decrement the Y register 	N,Z - IMPLIED MODE ONLY
 
         /* Shifts */
-        void ASL(enum ADDRESSING_MODE mode); 	// Arithmetic Shift Left 	N,Z,C
+        template<enum ADDRESSING_MODE mode> void ASL(); 	// Arithmetic Shift Left 	N,Z,C
         void ASL_eACC(); 	                    // ASL in Accumulator mode 	N,Z,C
-        void LSR(enum ADDRESSING_MODE mode); 	// Logical Shift Right 	    N,Z,C
+        template<enum ADDRESSING_MODE mode> void LSR(); 	// Logical Shift Right 	    N,Z,C
         void LSR_eACC();                        // LSR in Accumulator mode N,Z,C
-        void ROL(enum ADDRESSING_MODE mode); 	// Rotate Left 	            N,Z,C
+        template<enum ADDRESSING_MODE mode> void ROL(); 	// Rotate Left 	            N,Z,C
         void ROL_eACC();                        // ROL in Accumulator mode N,Z,C
-        void ROR(enum ADDRESSING_MODE mode); 	// Rotate Right 	        N,Z,C
+        template<enum ADDRESSING_MODE mode> void ROR(); 	// Rotate Right 	        N,Z,C
         void ROR_eACC();                        // ROR in Accumulator mode N,Z,C
 
         /* Jumps & Calls */
-        void JMP(enum ADDRESSING_MODE mode);    // Jump to another location 	 
+        template<enum ADDRESSING_MODE mode> void JMP();    // Jump to another location 	 
         void JSR(); 	                        // Jump to a subroutine 	 - ABSOLUTE MODE ONLY
         void RTS(); 	                        // Return from subroutine 	 - IMPLIED MODE ONLY
 
@@ -518,6 +677,7 @@ class CPU{
         void LAS_ILL();
         void SBX_ILL();
         void USBC_ILL();
+        void UNIMPLEMENTED_ILL(); // any illegal opcode without an implementation, has no effect
 
         // allow opcode enums to have their name printed
     public:
@@ -525,269 +685,7 @@ class CPU{
 
 };
 
-// make ADDRESSING_MODE enums printable
+// make OPCODE enums printable
 std::ostream& operator<<(std::ostream& out, const CPU::OPCODE value){
-    // wow this sucks, but whatever it works and its not very important
-    std::string str {};
-    switch(value){
-        case CPU::LDA_INDX: str = std::string("LDA_INDX"); return out << str;
-        case CPU::LDA_ZPG: str = std::string("LDA_ZPG"); return out << str;
-        case CPU::LDA_IMM: str = std::string("LDA_IMM"); return out << str;
-        case CPU::LDA_ABS: str = std::string("LDA_ABS"); return out << str;
-        case CPU::LDA_INDY: str = std::string("LDA_INDY"); return out << str;
-        case CPU::LDA_ZPGX: str = std::string("LDA_ZPGX"); return out << str;
-        case CPU::LDA_ABSY: str = std::string("LDA_ABSY"); return out << str;
-        case CPU::LDA_ABSX: str = std::string("LDA_ABSX"); return out << str;
-        case CPU::LDX_IMM: str = std::string("LDX_IMM"); return out << str;
-        case CPU::LDX_ZPG: str = std::string("LDX_ZPG"); return out << str;
-        case CPU::LDX_ABS: str = std::string("LDX_ABS"); return out << str;
-        case CPU::LDX_ZPGY: str = std::string("LDX_ZPGY"); return out << str;
-        case CPU::LDX_ABSY: str = std::string("LDX_ABSY"); return out << str;
-        case CPU::LDY_IMM: str = std::string("LDY_IMM"); return out << str;
-        case CPU::LDY_ZPG: str = std::string("LDY_ZPG"); return out << str;
-        case CPU::LDY_ABS: str = std::string("LDY_ABS"); return out << str;
-        case CPU::LDY_ZPGX: str = std::string("LDY_ZPGX"); return out << str;
-        case CPU::LDY_ABSX: str = std::string("LDY_ABSX"); return out << str;
-        case CPU::STA_INDX: str = std::string("STA_INDX"); return out << str;
-        case CPU::STA_ZPG: str = std::string("STA_ZPG"); return out << str;
-        case CPU::STA_ABS: str = std::string("STA_ABS"); return out << str;
-        case CPU::STA_INDY: str = std::string("STA_INDY"); return out << str;
-        case CPU::STA_ZPGX: str = std::string("STA_ZPGX"); return out << str;
-        case CPU::STA_ABSY: str = std::string("STA_ABSY"); return out << str;
-        case CPU::STA_ABSX: str = std::string("STA_ABSX"); return out << str;
-        case CPU::STX_ZPG: str = std::string("STX_ZPG"); return out << str;
-        case CPU::STX_ABS: str = std::string("STX_ABS"); return out << str;
-        case CPU::STX_ZPGY: str = std::string("STX_ZPGY"); return out << str;
-        case CPU::STY_ZPG: str = std::string("STY_ZPG"); return out << str;
-        case CPU::STY_ABS: str = std::string("STY_ABS"); return out << str;
-        case CPU::STY_ZPGX: str = std::string("STY_ZPGX"); return out << str;
-        case CPU::TAX_IMPL: str = std::string("TAX_IMPL"); return out << str;
-        case CPU::TAY_IMPL: str = std::string("TAY_IMPL"); return out << str;
-        case CPU::TXA_IMPL: str = std::string("TXA_IMPL"); return out << str;
-        case CPU::TYA_IMPL: str = std::string("TYA_IMPL"); return out << str;
-        case CPU::TSX_IMPL: str = std::string("TSX_IMPL"); return out << str;
-        case CPU::TXS_IMPL: str = std::string("TXS_IMPL"); return out << str;
-        case CPU::PHA_IMPL: str = std::string("PHA_IMPL"); return out << str;
-        case CPU::PHP_IMPL: str = std::string("PHP_IMPL"); return out << str;
-        case CPU::PLA_IMPL: str = std::string("PLA_IMPL"); return out << str;
-        case CPU::PLP_IMPL: str = std::string("PLP_IMPL"); return out << str;
-        case CPU::AND_INDX: str = std::string("AND_INDX"); return out << str;
-        case CPU::AND_ZPG: str = std::string("AND_ZPG"); return out << str;
-        case CPU::AND_IMM: str = std::string("AND_IMM"); return out << str;
-        case CPU::AND_ABS: str = std::string("AND_ABS"); return out << str;
-        case CPU::AND_INDY: str = std::string("AND_INDY"); return out << str;
-        case CPU::AND_ZPGX: str = std::string("AND_ZPGX"); return out << str;
-        case CPU::AND_ABSY: str = std::string("AND_ABSY"); return out << str;
-        case CPU::AND_ABSX: str = std::string("AND_ABSX"); return out << str;
-        case CPU::EOR_INDX: str = std::string("EOR_INDX"); return out << str;
-        case CPU::EOR_ZPG: str = std::string("EOR_ZPG"); return out << str;
-        case CPU::EOR_IMM: str = std::string("EOR_IMM"); return out << str;
-        case CPU::EOR_ABS: str = std::string("EOR_ABS"); return out << str;
-        case CPU::EOR_INDY: str = std::string("EOR_INDY"); return out << str;
-        case CPU::EOR_ZPGX: str = std::string("EOR_ZPGX"); return out << str;
-        case CPU::EOR_ABSY: str = std::string("EOR_ABSY"); return out << str;
-        case CPU::EOR_ABSX: str = std::string("EOR_ABSX"); return out << str;
-        case CPU::ORA_INDX: str = std::string("ORA_INDX"); return out << str;
-        case CPU::ORA_ZPG: str = std::string("ORA_ZPG"); return out << str;
-        case CPU::ORA_IMM: str = std::string("ORA_IMM"); return out << str;
-        case CPU::ORA_ABS: str = std::string("ORA_ABS"); return out << str;
-        case CPU::ORA_INDY: str = std::string("ORA_INDY"); return out << str;
-        case CPU::ORA_ZPGX: str = std::string("ORA_ZPGX"); return out << str;
-        case CPU::ORA_ABSY: str = std::string("ORA_ABSY"); return out << str;
-        case CPU::ORA_ABSX: str = std::string("ORA_ABSX"); return out << str;
-        case CPU::BIT_ZPG: str = std::string("BIT_ZPG"); return out << str;
-        case CPU::BIT_ABS: str = std::string("BIT_ABS"); return out << str;
-        case CPU::ADC_INDX: str = std::string("ADC_INDX"); return out << str;
-        case CPU::ADC_ZPG: str = std::string("ADC_ZPG"); return out << str;
-        case CPU::ADC_IMM: str = std::string("ADC_IMM"); return out << str;
-        case CPU::ADC_ABS: str = std::string("ADC_ABS"); return out << str;
-        case CPU::ADC_INDY: str = std::string("ADC_INDY"); return out << str;
-        case CPU::ADC_ZPGX: str = std::string("ADC_ZPGX"); return out << str;
-        case CPU::ADC_ABSY: str = std::string("ADC_ABSY"); return out << str;
-        case CPU::ADC_ABSX: str = std::string("ADC_ABSX"); return out << str;
-        case CPU::SBC_INDX: str = std::string("SBC_INDX"); return out << str;
-        case CPU::SBC_ZPG: str = std::string("SBC_ZPG"); return out << str;
-        case CPU::SBC_IMM: str = std::string("SBC_IMM"); return out << str;
-        case CPU::SBC_ABS: str = std::string("SBC_ABS"); return out << str;
-        case CPU::SBC_INDY: str = std::string("SBC_INDY"); return out << str;
-        case CPU::SBC_ZPGX: str = std::string("SBC_ZPGX"); return out << str;
-        case CPU::SBC_ABSY: str = std::string("SBC_ABSY"); return out << str;
-        case CPU::SBC_ABSX: str = std::string("SBC_ABSX"); return out << str;
-        case CPU::CMP_INDX: str = std::string("CMP_INDX"); return out << str;
-        case CPU::CMP_ZPG: str = std::string("CMP_ZPG"); return out << str;
-        case CPU::CMP_IMM: str = std::string("CMP_IMM"); return out << str;
-        case CPU::CMP_ABS: str = std::string("CMP_ABS"); return out << str;
-        case CPU::CMP_INDY: str = std::string("CMP_INDY"); return out << str;
-        case CPU::CMP_ZPGX: str = std::string("CMP_ZPGX"); return out << str;
-        case CPU::CMP_ABSY: str = std::string("CMP_ABSY"); return out << str;
-        case CPU::CMP_ABSX: str = std::string("CMP_ABSX"); return out << str;
-        case CPU::CPX_IMM: str = std::string("CPX_IMM"); return out << str;
-        case CPU::CPX_ZPG: str = std::string("CPX_ZPG"); return out << str;
-        case CPU::CPX_ABS: str = std::string("CPX_ABS"); return out << str;
-        case CPU::CPY_IMM: str = std::string("CPY_IMM"); return out << str;
-        case CPU::CPY_ZPG: str = std::string("CPY_ZPG"); return out << str;
-        case CPU::CPY_ABS: str = std::string("CPY_ABS"); return out << str;
-        case CPU::INC_ZPG: str = std::string("INC_ZPG"); return out << str;
-        case CPU::INC_ABS: str = std::string("INC_ABS"); return out << str;
-        case CPU::INC_ZPGX: str = std::string("INC_ZPGX"); return out << str;
-        case CPU::INC_ABSX: str = std::string("INC_ABSX"); return out << str;
-        case CPU::INX_IMPL: str = std::string("INX_IMPL"); return out << str;
-        case CPU::INY_IMPL: str = std::string("INY_IMPL"); return out << str;
-        case CPU::DEC_ZPG: str = std::string("DEC_ZPG"); return out << str;
-        case CPU::DEC_ABS: str = std::string("DEC_ABS"); return out << str;
-        case CPU::DEC_ZPGX: str = std::string("DEC_ZPGX"); return out << str;
-        case CPU::DEC_ABSX: str = std::string("DEC_ABSX"); return out << str;
-        case CPU::DEX_IMPL: str = std::string("DEX_IMPL"); return out << str;
-        case CPU::DEY_IMPL: str = std::string("DEY_IMPL"); return out << str;
-        case CPU::ASL_ZPG: str = std::string("ASL_ZPG"); return out << str;
-        case CPU::ASL_ACC: str = std::string("ASL_ACC"); return out << str;
-        case CPU::ASL_ABS: str = std::string("ASL_ABS"); return out << str;
-        case CPU::ASL_ZPGX: str = std::string("ASL_ZPGX"); return out << str;
-        case CPU::ASL_ABSX: str = std::string("ASL_ABSX"); return out << str;
-        case CPU::LSR_ZPG: str = std::string("LSR_ZPG"); return out << str;
-        case CPU::LSR_ACC: str = std::string("LSR_ACC"); return out << str;
-        case CPU::LSR_ABS: str = std::string("LSR_ABS"); return out << str;
-        case CPU::LSR_ZPGX: str = std::string("LSR_ZPGX"); return out << str;
-        case CPU::LSR_ABSX: str = std::string("LSR_ABSX"); return out << str;
-        case CPU::ROL_ZPG: str = std::string("ROL_ZPG"); return out << str;
-        case CPU::ROL_ACC: str = std::string("ROL_ACC"); return out << str;
-        case CPU::ROL_ABS: str = std::string("ROL_ABS"); return out << str;
-        case CPU::ROL_ZPGX: str = std::string("ROL_ZPGX"); return out << str;
-        case CPU::ROL_ABSX: str = std::string("ROL_ABSX"); return out << str;
-        case CPU::ROR_ZPG: str = std::string("ROR_ZPG"); return out << str;
-        case CPU::ROR_ACC: str = std::string("ROR_ACC"); return out << str;
-        case CPU::ROR_ABS: str = std::string("ROR_ABS"); return out << str;
-        case CPU::ROR_ZPGX: str = std::string("ROR_ZPGX"); return out << str;
-        case CPU::ROR_ABSX: str = std::string("ROR_ABSX"); return out << str;
-        case CPU::JMP_ABS: str = std::string("JMP_ABS"); return out << str;
-        case CPU::JMP_IND: str = std::string("JMP_IND"); return out << str;
-        case CPU::JSR_ABS: str = std::string("JSR_ABS"); return out << str;
-        case CPU::RTS_IMPL: str = std::string("RTS_IMPL"); return out << str;
-        case CPU::BCC_REL: str = std::string("BCC_REL"); return out << str;
-        case CPU::BCS_REL: str = std::string("BCS_REL"); return out << str;
-        case CPU::BEQ_REL: str = std::string("BEQ_REL"); return out << str;
-        case CPU::BMI_REL: str = std::string("BMI_REL"); return out << str;
-        case CPU::BNE_REL: str = std::string("BNE_REL"); return out << str;
-        case CPU::BPL_REL: str = std::string("BPL_REL"); return out << str;
-        case CPU::BVC_REL: str = std::string("BVC_REL"); return out << str;
-        case CPU::BVS_REL: str = std::string("BVS_REL"); return out << str;
-        case CPU::CLC_IMPL: str = std::string("CLC_IMPL"); return out << str;
-        case CPU::CLD_IMPL: str = std::string("CLD_IMPL"); return out << str;
-        case CPU::CLI_IMPL: str = std::string("CLI_IMPL"); return out << str;
-        case CPU::CLV_IMPL: str = std::string("CLV_IMPL"); return out << str;
-        case CPU::SEC_IMPL: str = std::string("SEC_IMPL"); return out << str;
-        case CPU::SED_IMPL: str = std::string("SED_IMPL"); return out << str;
-        case CPU::SEI_IMPL: str = std::string("SEI_IMPL"); return out << str;
-        case CPU::BRK_IMPL: str = std::string("BRK_IMPL"); return out << str;
-        case CPU::NOP_IMPL: str = std::string("NOP_IMPL"); return out << str;
-        case CPU::RTI_IMPL: str = std::string("RTI_IMPL"); return out << str;
-        case CPU::NOP_IMM_ILL0: str = std::string("NOP_IMM_ILL0"); return out << str;
-        case CPU::NOP_IMM_ILL1: str = std::string("NOP_IMM_ILL1"); return out << str;
-        case CPU::NOP_IMM_ILL2: str = std::string("NOP_IMM_ILL2"); return out << str;
-        case CPU::NOP_IMM_ILL3: str = std::string("NOP_IMM_ILL3"); return out << str;
-        case CPU::NOP_IMM_ILL4: str = std::string("NOP_IMM_ILL4"); return out << str;
-        case CPU::NOP_ZPG_ILL0: str = std::string("NOP_ZPG_ILL0"); return out << str;
-        case CPU::NOP_ZPG_ILL1: str = std::string("NOP_ZPG_ILL1"); return out << str;
-        case CPU::NOP_ZPG_ILL2: str = std::string("NOP_ZPG_ILL2"); return out << str;
-        case CPU::NOP_ZPGX_ILL0: str = std::string("NOP_ZPGX_ILL0"); return out << str;
-        case CPU::NOP_ZPGX_ILL1: str = std::string("NOP_ZPGX_ILL1"); return out << str;
-        case CPU::NOP_ZPGX_ILL2: str = std::string("NOP_ZPGX_ILL2"); return out << str;
-        case CPU::NOP_ZPGX_ILL3: str = std::string("NOP_ZPGX_ILL3"); return out << str;
-        case CPU::NOP_ZPGX_ILL4: str = std::string("NOP_ZPGX_ILL4"); return out << str;
-        case CPU::NOP_ZPGX_ILL5: str = std::string("NOP_ZPGX_ILL5"); return out << str;
-        case CPU::NOP_IMPL_ILL0: str = std::string("NOP_IMPL_ILL0"); return out << str;
-        case CPU::NOP_IMPL_ILL1: str = std::string("NOP_IMPL_ILL1"); return out << str;
-        case CPU::NOP_IMPL_ILL2: str = std::string("NOP_IMPL_ILL2"); return out << str;
-        case CPU::NOP_IMPL_ILL3: str = std::string("NOP_IMPL_ILL3"); return out << str;
-        case CPU::NOP_IMPL_ILL4: str = std::string("NOP_IMPL_ILL4"); return out << str;
-        case CPU::NOP_IMPL_ILL5: str = std::string("NOP_IMPL_ILL5"); return out << str;
-        case CPU::NOP_ABS_ILL : str = std::string("NOP_ABS_ILL "); return out << str;
-        case CPU::NOP_ABSX_ILL0: str = std::string("NOP_ABSX_ILL0"); return out << str;
-        case CPU::NOP_ABSX_ILL1: str = std::string("NOP_ABSX_ILL1"); return out << str;
-        case CPU::NOP_ABSX_ILL2: str = std::string("NOP_ABSX_ILL2"); return out << str;
-        case CPU::NOP_ABSX_ILL3: str = std::string("NOP_ABSX_ILL3"); return out << str;
-        case CPU::NOP_ABSX_ILL4: str = std::string("NOP_ABSX_ILL4"); return out << str;
-        case CPU::NOP_ABSX_ILL5: str = std::string("NOP_ABSX_ILL5"); return out << str;
-        case CPU::JAM_IMPL_ILL0: str = std::string("JAM_IMPL_ILL0"); return out << str;
-        case CPU::JAM_IMPL_ILL1: str = std::string("JAM_IMPL_ILL1"); return out << str;
-        case CPU::JAM_IMPL_ILL2: str = std::string("JAM_IMPL_ILL2"); return out << str;
-        case CPU::JAM_IMPL_ILL3: str = std::string("JAM_IMPL_ILL3"); return out << str;
-        case CPU::JAM_IMPL_ILL4: str = std::string("JAM_IMPL_ILL4"); return out << str;
-        case CPU::JAM_IMPL_ILL5: str = std::string("JAM_IMPL_ILL5"); return out << str;
-        case CPU::JAM_IMPL_ILL6: str = std::string("JAM_IMPL_ILL6"); return out << str;
-        case CPU::JAM_IMPL_ILL7: str = std::string("JAM_IMPL_ILL7"); return out << str;
-        case CPU::JAM_IMPL_ILL8: str = std::string("JAM_IMPL_ILL8"); return out << str;
-        case CPU::JAM_IMPL_ILL9: str = std::string("JAM_IMPL_ILL9"); return out << str;
-        case CPU::JAM_IMPL_ILL10: str = std::string("JAM_IMPL_ILL10"); return out << str;
-        case CPU::JAM_IMPL_ILL11: str = std::string("JAM_IMPL_ILL11"); return out << str;
-        case CPU::SLO_INDX_ILL: str = std::string("SLO_INDX_ILL"); return out << str;
-        case CPU::SLO_INDY_ILL: str = std::string("SLO_INDY_ILL"); return out << str;
-        case CPU::SLO_ZPG_ILL: str = std::string("SLO_ZPG_ILL"); return out << str;
-        case CPU::SLO_ZPGX_ILL: str = std::string("SLO_ZPGX_ILL"); return out << str;
-        case CPU::SLO_ABSY_ILL: str = std::string("SLO_ABSY_ILL"); return out << str;
-        case CPU::SLO_ABS_ILL: str = std::string("SLO_ABS_ILL"); return out << str;
-        case CPU::SLO_ABSX_ILL: str = std::string("SLO_ABSX_ILL"); return out << str;
-        case CPU::RLA_INDX_ILL: str = std::string("RLA_INDX_ILL"); return out << str;
-        case CPU::RLA_INDY_ILL: str = std::string("RLA_INDY_ILL"); return out << str;
-        case CPU::RLA_ZPG_ILL: str = std::string("RLA_ZPG_ILL"); return out << str;
-        case CPU::RLA_ZPGX_ILL: str = std::string("RLA_ZPGX_ILL"); return out << str;
-        case CPU::RLA_ABSY_ILL: str = std::string("RLA_ABSY_ILL"); return out << str;
-        case CPU::RLA_ABS_ILL: str = std::string("RLA_ABS_ILL"); return out << str;
-        case CPU::RLA_ABSX_ILL: str = std::string("RLA_ABSX_ILL"); return out << str;
-        case CPU::SRE_INDX_ILL: str = std::string("SRE_INDX_ILL"); return out << str;
-        case CPU::SRE_INDY_ILL: str = std::string("SRE_INDY_ILL"); return out << str;
-        case CPU::SRE_ZPG_ILL: str = std::string("SRE_ZPG_ILL"); return out << str;
-        case CPU::SRE_ZPGX_ILL: str = std::string("SRE_ZPGX_ILL"); return out << str;
-        case CPU::SRE_ABSY_ILL: str = std::string("SRE_ABSY_ILL"); return out << str;
-        case CPU::SRE_ABS_ILL: str = std::string("SRE_ABS_ILL"); return out << str;
-        case CPU::SRE_ABSX_ILL: str = std::string("SRE_ABSX_ILL"); return out << str;
-        case CPU::RRA_INDX_ILL: str = std::string("RRA_INDX_ILL"); return out << str;
-        case CPU::RRA_INDY_ILL: str = std::string("RRA_INDY_ILL"); return out << str;
-        case CPU::RRA_ZPG_ILL: str = std::string("RRA_ZPG_ILL"); return out << str;
-        case CPU::RRA_ZPGX_ILL: str = std::string("RRA_ZPGX_ILL"); return out << str;
-        case CPU::RRA_ABSY_ILL: str = std::string("RRA_ABSY_ILL"); return out << str;
-        case CPU::RRA_ABS_ILL: str = std::string("RRA_ABS_ILL"); return out << str;
-        case CPU::RRA_ABSX_ILL: str = std::string("RRA_ABSX_ILL"); return out << str;
-        case CPU::SAX_INDX_ILL: str = std::string("SAX_INDX_ILL"); return out << str;
-        case CPU::SAX_ZPG_ILL: str = std::string("SAX_ZPG_ILL"); return out << str;
-        case CPU::SAX_ZPGY_ILL: str = std::string("SAX_ZPGY_ILL"); return out << str;
-        case CPU::SAX_ABS_ILL: str = std::string("SAX_ABS_ILL"); return out << str;
-        case CPU::LAX_INDX_ILL: str = std::string("LAX_INDX_ILL"); return out << str;
-        case CPU::LAX_INDY_ILL: str = std::string("LAX_INDY_ILL"); return out << str;
-        case CPU::LAX_ZPG_ILL: str = std::string("LAX_ZPG_ILL"); return out << str;
-        case CPU::LAX_ZPGY_ILL: str = std::string("LAX_ZPGY_ILL"); return out << str;
-        case CPU::LAX_ABS_ILL: str = std::string("LAX_ABS_ILL"); return out << str;
-        case CPU::LAX_ABSY_ILL: str = std::string("LAX_ABSY_ILL"); return out << str;
-        case CPU::DCP_INDX_ILL: str = std::string("DCP_INDX_ILL"); return out << str;
-        case CPU::DCP_INDY_ILL: str = std::string("DCP_INDY_ILL"); return out << str;
-        case CPU::DCP_ZPG_ILL: str = std::string("DCP_ZPG_ILL"); return out << str;
-        case CPU::DCP_ZPGX_ILL: str = std::string("DCP_ZPGX_ILL"); return out << str;
-        case CPU::DCP_ABSY_ILL: str = std::string("DCP_ABSY_ILL"); return out << str;
-        case CPU::DCP_ABS_ILL: str = std::string("DCP_ABS_ILL"); return out << str;
-        case CPU::DCP_ABSX_ILL: str = std::string("DCP_ABSX_ILL"); return out << str;
-        case CPU::ISC_INDX_ILL: str = std::string("ISC_INDX_ILL"); return out << str;
-        case CPU::ISC_INDY_ILL: str = std::string("ISC_INDY_ILL"); return out << str;
-        case CPU::ISC_ZPG_ILL: str = std::string("ISC_ZPG_ILL"); return out << str;
-        case CPU::ISC_ZPGX_ILL: str = std::string("ISC_ZPGX_ILL"); return out << str;
-        case CPU::ISC_ABSY_ILL: str = std::string("ISC_ABSY_ILL"); return out << str;
-        case CPU::ISC_ABS_ILL: str = std::string("ISC_ABS_ILL"); return out << str;
-        case CPU::ISC_ABSX_ILL: str = std::string("ISC_ABSX_ILL"); return out << str;
-        case CPU::ANC_IMM_ILL0: str = std::string("ANC_IMM_ILL0"); return out << str;
-        case CPU::ANC_IMM_ILL1: str = std::string("ANC_IMM_ILL1"); return out << str;
-        case CPU::ALR_IMM_ILL: str = std::string("ALR_IMM_ILL"); return out << str;
-        case CPU::ARR_IMM_ILL: str = std::string("ARR_IMM_ILL"); return out << str;
-        case CPU::ANE_IMM_ILL: str = std::string("ANE_IMM_ILL"); return out << str;
-        case CPU::SHA_INDY_ILL: str = std::string("SHA_INDY_ILL"); return out << str;
-        case CPU::SHA_ABSY_ILL: str = std::string("SHA_ABSY_ILL"); return out << str;
-        case CPU::SHY_ABSX_ILL: str = std::string("SHY_ABSX_ILL"); return out << str;
-        case CPU::SHX_ABSY_ILL: str = std::string("SHX_ABSY_ILL"); return out << str;
-        case CPU::TAS_ABSY_ILL: str = std::string("TAS_ABSY_ILL"); return out << str;
-        case CPU::LXA_IMM_ILL: str = std::string("LXA_IMM_ILL"); return out << str;
-        case CPU::LAS_ABSY_ILL: str = std::string("LAS_ABSY_ILL"); return out << str;
-        case CPU::SBX_IMM_ILL: str = std::string("SBX_IMM_ILL"); return out << str;
-        case CPU::USBC_IMM_ILL: str = std::string("USBC_IMM_ILL"); return out << str;
-        default: str = std::string("UNKNOWN"); return out << str; // unreachable 
-    }
+    return out << CPU::instruction_table[value].name;
 };
-
-
@@ -10,6 +10,7 @@ class DMABus{
         DMABus(RAM& _ram);
 
         uint8_t read(uint16_t addr);
+        void    read_page(uint8_t page, uint8_t* dest); // copies the 256 bytes at (page << 8) into dest
 
     private:
         RAM& ram;
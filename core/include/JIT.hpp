@@ -0,0 +1,127 @@
+#pragma once
+
+#if !defined(__x86_64__)
+#error "VNES_JIT emits x86-64 machine code and can only be built for x86-64 hosts"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "RAM.hpp"
+
+/*
+ * Translates straight-line runs of PRG-ROM code (0x8000 - 0xFFFF) into native
+ * x86-64 functions. Only instructions whose operands are immediates or
+ * internal RAM (0x0000 - 0x1FFF) are translated. Anything touching PPU/APU/IO
+ * registers or the cartridge ends the block, and the CPU interprets that
+ * instruction as usual. This means a block never has side effects outside
+ * of the CPU registers and internal RAM.
+ *
+ * A block ends with a conditional branch, a JMP, or the first instruction
+ * that can't be translated. Cycles are added up when the block is compiled.
+ * Branches are the only instruction with a variable cycle count, and they
+ * are always last, so each exit stores its own total.
+ *
+ * Translations are keyed by PC alone, and everything is thrown away when the
+ * cartridge's PRG generation changes (bank switch or a write into ROM).
+ * Writes to internal RAM need no invalidation since code there is never
+ * translated.
+ */
+class JIT{
+    public:
+        JIT(RAM& _ram);
+        ~JIT();
+
+        /* Guest state shared with translated code. The CPU copies its
+         * registers in before calling a block and out again afterwards.
+         * Generated code addresses fields by offsetof(), so keep this a
+         * plain struct.
+         */
+        struct State{
+            uint8_t accumulator;
+            uint8_t index_X;
+            uint8_t index_Y;
+            uint8_t carry_f;
+            uint8_t overflow_f;
+            uint8_t decimal_f;
+            uint8_t interrupt_disable_f;
+            uint8_t unused;
+            uint16_t nz_result;         // same encoding as CPU::nz_result
+            uint16_t program_counter;   // set by the block: address of the next instruction
+            uint32_t cycles;            // set by the block: CPU cycles it took
+            uint8_t* ram;               // internal RAM, see RAM::internal_ram()
+        };
+        State state;
+
+        typedef void (*BlockCode)(State* state);
+        struct Block{
+            BlockCode code;
+            uint32_t cycles_before_exit; // cycles of every instruction but the last
+            uint16_t instructions;
+        };
+
+        // Returns the translation for the block starting at pc, compiling
+        // it once it gets hot. Returns nullptr if the block should be
+        // interpreted instead. Only valid until the next lookup().
+        Block* lookup(uint16_t pc);
+
+    private:
+        RAM& ram;
+
+        static constexpr size_t CODE_BUFFER_SIZE = 4 << 20;
+        static constexpr size_t MAX_BLOCK_CODE_SIZE = 4096; // comfortably above MAX_BLOCK_INSTRUCTIONS of the largest instruction
+        static constexpr int MAX_BLOCK_INSTRUCTIONS = 32;
+        static constexpr uint8_t HOT_THRESHOLD = 8; // times a PC must start a block before it is compiled
+
+        static constexpr int32_t NOT_COMPILED = -1;
+        static constexpr int32_t UNCOMPILABLE = -2;
+
+        uint8_t* code_buffer; // executable memory, nullptr if it couldn't be mapped
+        size_t code_used;
+        uint32_t generation;
+
+        std::vector<Block> blocks;
+        int32_t block_index[0x8000]; // index into blocks for each PRG-ROM address, or NOT_COMPILED/UNCOMPILABLE
+        uint8_t heat[0x8000];
+
+        void flush();
+        bool compile(uint16_t start_pc, Block& block);
+
+        /* translation of single instructions */
+        enum Op : uint8_t{
+            UNSUPPORTED = 0,
+            LDA, LDX, LDY, STA, STX, STY,
+            AND, ORA, EOR, ADC, SBC, CMP, CPX, CPY,
+            INC, DEC, ASL, LSR, ROL, ROR,
+            INX, INY, DEX, DEY, TAX, TAY, TXA, TYA,
+            CLC, SEC, CLV, CLD, SED, SEI, NOP,
+            BCC, BCS, BEQ, BNE, BMI, BPL, BVC, BVS, JMP
+        };
+        enum Mode : uint8_t{ NONE, ACC, IMM, ZPG, ZPGX, ZPGY, ABS, REL };
+        struct Decoded{ Op op; Mode mode; };
+        static Decoded decode(uint8_t opcode);
+
+        struct Operand{ Mode mode; uint16_t value; }; // immediate value or RAM address
+
+        void emit_instruction(Op op, Operand operand);
+        void emit_branch(Op op, uint16_t fallthrough_pc, uint32_t fallthrough_cycles, uint16_t target_pc, uint32_t target_cycles);
+        void emit_exit(uint16_t next_pc, uint32_t cycles);
+
+        /* x86-64 encoding */
+        enum Reg : uint8_t{ EAX = 0, ECX = 1, EDX = 2, RSI = 6, RDI = 7 };
+        std::vector<uint8_t> code; // block being compiled
+
+        void emit(std::initializer_list<uint8_t> bytes);
+        void emit16(uint16_t value);
+        void emit32(uint32_t value);
+        static uint8_t modrm(uint8_t mod, uint8_t reg, uint8_t rm){ return (mod << 6) | ((reg & 7) << 3) | (rm & 7); }
+
+        void load_field(Reg r, size_t field);
+        void store_field(Reg r, size_t field);
+        void store_field_imm(size_t field, uint8_t value);
+        void store_nz(Reg r);
+        void zero_extend(Reg dst, Reg src);
+        void load_operand(Reg r, Operand operand); // leaves the address in EDX for indexed modes
+        void store_operand(Reg r, Operand operand); // expects the address in EDX for indexed modes
+        void address_to_edx(Operand operand);
+};
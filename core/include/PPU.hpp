@@ -3,15 +3,28 @@
 //#include "RAM.hpp"
 #include "../../cartridge/cartridge.hpp"
 #include "DMABus.hpp"
+#include "Scheduler.hpp"
+#include "../PixelKernels.cpp"
 #include "../../common/typedefs.hpp"
+#include <algorithm>
+#if defined(VNES_RENDER_THREAD)
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif
 
 class PPU{
     public:
         //PPU(RAM& _ram, Cartridge& _cart);
-        PPU(Cartridge& _cart, DMABus& _dmabus);
+        PPU(Cartridge& _cart, DMABus& _dmabus, Scheduler& _scheduler);
+#if defined(VNES_RENDER_THREAD)
+        ~PPU();
+#endif
         void power_up();
         void reset();
-        void do_cycles(int cycles_to_do);
+        void run_until(uint64_t target_timestamp); // catches up to a master clock timestamp
 
         void register_write(uint16_t addr, uint8_t data);
         uint8_t register_read(uint16_t addr);
@@ -19,10 +32,35 @@ class PPU{
         //void    write(uint16_t addr, uint8_t data);
         //uint8_t read(uint16_t addr);
 
-        bool check_nmi();
+        // PPU_STATUS as the CPU would read it, without clearing anything
+        uint8_t peek_status(){ return ppu_status; }
 
         //int buffer[256][224]; // x = 256, y = 244, so index as buffer[x][y]
-        int buffer[256*224]; 
+        int buffer[256*224]; // in RGBA_OUTPUT, see output_colour() for the format
+
+        /* output */
+        /*
+         * In RGBA_OUTPUT the PPU writes finished colours to buffer. In
+         * INDEXED_OUTPUT it writes each pixel's colour number (0-63) to
+         * indexed_buffer and leaves the conversion to present(), which
+         * only needs doing for frames that are actually shown. Emphasis
+         * and grayscale are kept per line in indexed mode, from the last
+         * pixel written to it.
+         */
+        enum OutputMode : uint8_t{ RGBA_OUTPUT, INDEXED_OUTPUT };
+        OutputMode output_mode = RGBA_OUTPUT;
+        uint8_t indexed_buffer[256*224];
+        uint8_t indexed_variant[224]; // colour_variant() of each line
+
+        void present(int* out); // indexed_buffer to colours, as they'd be in buffer
+
+        // Frames that start while this is set are run without drawing
+        // anything: buffer keeps the last frame that was drawn, but timing,
+        // NMI, sprite 0 hit and sprite overflow are the same. For fast
+        // forward and runs where nobody looks at the picture.
+        bool render_skip = false;
+        void set_palette(const uint32_t* rgb); // 64 colours as 0xRRGGBB
+        bool load_palette(const std::string& filename); // a .pal file of 64 RGB triples, keeps the current palette on failure
 
         // see https://8bitworkshop.com/blog/platforms/nintendo-nes.md.html for
         // bit-values in specific registers
@@ -76,12 +114,53 @@ class PPU{
          * 0x3F00 - 0x3F1F: 	0x0020 	Palette RAM indexes 	Internal to PPU
          * 0x3F20 - 0x3FFF: 	0x00E0 	Mirrors of $3F00-$3F1F 	Internal to PPU
          */
-        uint8_t vram[0x4000]; // 0x4000 = 16384 bytes = 14-bit address line
-                                 // see https://www.nesdev.org/wiki/PPU_memory_map
-                              // 0x0000 - 0x1FFF of this array are unused since
-                              // accesses there are rerouted to pallete data on the cart,
-                              // but keeping the array this size makes addressing easier
+        /*
+         * The address space is split into 16 pages of 1KiB, see map_vram().
+         * Pages 0-7 are the pattern tables and point into CHR on the
+         * cartridge, pages 8-11 are the four nametables and point into CIRAM
+         * (or cartridge RAM) as the cartridge mirrors them, and pages 12-15
+         * mirror pages 8-11. Palette RAM sits on top of 0x3F00 - 0x3FFF and
+         * is handled separately.
+         */
+        uint8_t* vram_pages[16];
+        uint8_t ciram[0x800]; // 2KiB internal VRAM, room for two nametables
+        uint8_t palette_ram[0x20];
+        uint8_t unmapped_page[0x400]; // stands in for anything the cartridge doesn't map
+        uint32_t seen_chr_generation;
+
+        /*
+         * The pattern tables as the renderers want them: each row of each
+         * of the 512 tiles in pages 0-7 decoded to 8 pixels of 0-3, and
+         * again mirrored for horizontally flipped sprites. A tile is decoded
+         * the first time it's used after map_vram() or a write into it.
+         * Writes are seen by their PPU address, so a mapper that maps the
+         * same CHR memory into two pages would need both invalidated.
+         */
+        uint8_t tile_cache[2][512 * 8][8]; // [flipped][tile * 8 + row][column]
+        bool tile_valid[512];
+        const uint8_t* tile_row(uint16_t addr, bool flipped); // addr of the row's low plane byte
+        void decode_tile(uint16_t tile);
 
+        /*
+         * The background of all four nametables drawn out as one 512x480
+         * image of palette indices (attribute << 2 | pattern), laid out as
+         * the nametables are at 0x2000 - 0x2FFF. The scanline renderer cuts
+         * each line out of it at the scroll position, so a screen that
+         * doesn't change is only drawn once. Tiles are redrawn when they're
+         * next needed after a write to their nametable entry, their
+         * attribute byte or their pattern. Everything is redrawn after the
+         * background pattern table, the CHR banks or the mirroring change.
+         */
+        uint8_t nametable_bitmap[480][512];
+        bool bitmap_tile_valid[4][30 * 32];
+        bool bitmap_pattern_stale[256]; // background patterns written since the tiles were drawn
+        bool bitmap_patterns_stale;     // any of the above
+        void invalidate_bitmap(uint16_t addr);
+        void invalidate_whole_bitmap(){ std::fill(&bitmap_tile_valid[0][0], &bitmap_tile_valid[0][0] + 4 * 30 * 32, false); }
+        void draw_bitmap_tile(int table, int tile);
+
+        void map_vram(); // points vram_pages at the cartridge's current banks and mirroring
+        uint8_t& palette_entry(uint16_t addr);
         uint8_t vram_read(uint16_t addr);
         void vram_write(uint16_t addr, uint8_t data);
 
@@ -91,8 +170,6 @@ class PPU{
         uint8_t ppu_status;
         uint8_t ppu_oam_addr;
         uint8_t ppu_oam_data;
-        uint16_t ppu_scroll;
-        uint16_t ppu_addr;
         uint8_t ppu_data;
         uint8_t ppu_oam_dma;
 
@@ -104,6 +181,16 @@ class PPU{
         uint8_t OAM_PRIMARY[4*64]; // primary OAM can hold 64 sprites, each 4 bytes long
         uint8_t OAM_SECONDARY[4*8]; // secondary OAM holds only 8 sprites
 
+        // Which sprites are on each line, kept from frame to frame instead
+        // of checking all 64 sprites on every line. They only depend on the
+        // sprites' Y and the sprite height, so they're rebuilt by
+        // update_sprite_lists() when one of those changes.
+        uint8_t sprite_lists[240][8]; // indices into OAM, in OAM order
+        uint8_t sprite_list_length[240];
+        bool sprite_list_overflow[240]; // more than 8 sprites on the line
+        bool sprite_lists_stale;
+        void update_sprite_lists();
+
         // internal registers, see https://www.nesdev.org/wiki/PPU_scrolling
         uint16_t reg_v; // 15 bits, current VRAM address. Note PPU address is 14 bits wide, so top bit unused through 0x2007
         uint16_t reg_t; // 15 bits, temp VRAM address (also thought as address of top left onscreen tile)
@@ -113,7 +200,9 @@ class PPU{
         //RAM& ram;
         Cartridge& cart;
         DMABus& dmabus;
+        Scheduler& scheduler;
         
+        uint64_t timestamp; // master clock time the PPU has caught up to
         uint64_t cycles_since_reset;
         int frame_cycle;
         //int scanline_cycle;
@@ -131,6 +220,165 @@ class PPU{
         //uint8_t internal_read(uint16_t addr);
 
         void cycle();
+        void advance_dot();
+
+        // the timing of each kind of line, see build_phase_tables()
+        enum LineKind : uint8_t{ PRE_RENDER_LINE, VISIBLE_LINE, POST_RENDER_LINE, VBLANK_START_LINE, VBLANK_LINE, LINE_KINDS };
+        static constexpr int DOTS_PER_LINE = 341;
+        struct PhaseTables{
+            uint16_t next_busy_dot[LINE_KINDS][2][DOTS_PER_LINE]; // [kind][rendering enabled][dot]
+        };
+        static const PhaseTables PHASE_TABLES;
+        static PhaseTables build_phase_tables();
+        static LineKind line_kind(int scanline);
+        int line_length() const;
+        int next_busy_dot() const;
+        void skip_dots(int count);
+        void step_dot();
+
+        /* rendering */
+        /*
+         * Lines are drawn by one of two renderers, picked per line. A line
+         * is fetched from dot 321 of the line before (dot 1 for the
+         * pre-render line) to its dot 256, its fetch window. In SCANLINE
+         * mode the whole line is drawn at the start of its window from the
+         * registers at that point, and the line's effects on reg_v are
+         * applied in bulk on the dots where they'd be done. That only holds
+         * if the CPU leaves the registers alone during the window, so the
+         * first register access inside it rewinds the line to the start of
+         * the window and replays it in DOT mode, which fetches and shifts
+         * one dot at a time like the hardware, until the next window.
+         */
+        bool skipping_frame; // render_skip as it was at the start of the frame
+        bool draws_pixels() const { return !skipping_frame && !renders_on_thread(); }
+
+        enum LineMode : uint8_t{ SCANLINE, DOT };
+        LineMode line_mode;
+        uint16_t window_v; // reg_v at the start of the current fetch window
+
+        // where the scanline renderer found sprite 0 hit on the line it drew,
+        // the flag is set when the PPU gets to that dot (-1 for no hit)
+        int sprite0_hit_line;
+        int sprite0_hit_dot;
+
+        // background pipeline of the dot renderer
+        uint16_t bg_shift_pattern_lo;
+        uint16_t bg_shift_pattern_hi;
+        uint16_t bg_shift_attrib_lo;
+        uint16_t bg_shift_attrib_hi;
+        uint8_t next_tile_id;
+        uint8_t next_tile_attrib;
+        uint8_t next_tile_lo;
+        uint8_t next_tile_hi;
+
+        // sprites on the line being drawn, in OAM order
+        struct Sprite{
+            uint8_t x;
+            uint8_t attributes;
+            uint8_t pixels[8]; // already flipped horizontally if need be
+            bool sprite0;
+        };
+        Sprite line_sprites[8];
+        int line_sprite_count;
+
+        static const uint32_t SYSTEM_PALETTE[64]; // used until set_palette() is called
+
+        // every colour as it comes out of the PPU for each combination of
+        // the emphasis and grayscale bits of PPU_MASK, built by set_palette()
+        uint32_t colour_table[16][64]; // [colour_variant()][colour]
+        uint8_t colour_variant() const { return ((ppu_mask >> 4) & 0x0E) | (ppu_mask & 0x01); }
+        PixelKernels pixel_kernels;
+
+        bool rendering_enabled() const { return ppu_mask & 0x18; }
+        uint16_t background_table() const { return (ppu_ctrl & 0x10) ? 0x1000 : 0x0000; }
+        bool in_fetch_window() const;
+        void switch_to_dot_mode();
+        void render_scanline_dot();
+        void render_dot();
+        void render_line(int line);
+        void background_from_tiles(uint8_t* bg);
+        void background_from_bitmap(uint8_t* bg);
+        void load_background_shifters();
+        void evaluate_sprites(int line);
+        uint8_t compose_pixel(int x, uint8_t bg, bool& sprite0_hit);
+        void put_pixel(int line, int x, uint8_t palette_index);
+        void put_line(int line, const uint8_t* palette_indices);
+        uint32_t output_colour(uint8_t palette_index);
+
+        static uint16_t increment_coarse_x(uint16_t v);
+        static uint16_t increment_y(uint16_t v);
+
+        // dots until the vblank flag is set, counting the dot that sets it
+        int dots_until(int target_scanline, int target_dot);
+        int dots_until_vblank();
+        void schedule_vblank();
+        void schedule_status();
+        uint64_t next_sprite0_time();
+        uint64_t next_overflow_time();
+
+        /* render thread */
+#if defined(VNES_RENDER_THREAD)
+        /*
+         * With VNES_RENDER_THREAD the pixels are drawn on a second thread,
+         * while the CPU thread carries on with the next frame. The PPU the
+         * CPU talks to still runs every dot, since the CPU can see its
+         * flags, scroll registers and memory. But it only works out the
+         * pixels it needs for sprite 0 hit. Everything the CPU does to the
+         * PPU is logged with the PPU's timestamp:
+         *  - register writes, with the page for OAM DMA;
+         *  - reads of PPU_STATUS and PPU_DATA, which change w and v;
+         *  - CHR bank and mirroring changes, with a copy of the new pages,
+         *    at the dot of the cartridge write (the CPU catches the PPU up
+         *    before every one);
+         *  - resets.
+         * At the start of vblank the log is handed to the render thread.
+         * There, a replica PPU with its own copy of VRAM plays the log back
+         * at the same timestamps, so it draws what this PPU would have
+         * drawn. buffer shows the frame before the one just emulated.
+         */
+        struct RenderEvent{
+            enum Type : uint8_t{ REGISTER_WRITE, REGISTER_READ, MAP_PAGES, RESET };
+            uint64_t timestamp;
+            uint32_t payload; // offset into RenderLog::payload
+            uint16_t addr;
+            uint8_t data;
+            Type type;
+        };
+        struct RenderLog{
+            std::vector<RenderEvent> events;
+            std::vector<uint8_t> payload;
+            uint64_t end_timestamp;
+        };
+
+        PPU(Cartridge& _cart, DMABus& _dmabus, Scheduler& _scheduler, bool _replica); // for the render thread
+
+        std::unique_ptr<PPU> replica; // on the CPU thread's PPU only
+        Scheduler replica_scheduler;  // takes the replica's NMIs and DMA stalls, which go nowhere
+        const bool is_replica;
+        const uint8_t* replay_dma_page = nullptr; // OAM DMA data while replaying, instead of the DMA bus
+
+        RenderLog render_logs[2];
+        int filling_log = 0; // being written by the CPU thread, the other is the render thread's
+        bool render_busy = false;
+        bool render_quit = false;
+        std::mutex render_mutex;
+        std::condition_variable render_wake;
+        std::condition_variable render_done;
+        std::thread render_thread;
 
+        // VRAM of the replica, copied from the pages mapped when the log was written
+        uint8_t replayed_pages[12][0x400];
 
+        bool renders_on_thread() const { return replica != nullptr; }
+        bool replaying() const { return is_replica; }
+        void log_render_event(RenderEvent::Type type, uint16_t addr = 0, uint8_t data = 0, const uint8_t* payload = nullptr, size_t payload_size = 0);
+        void log_mapped_pages();
+        void hand_off_frame();
+        void render_thread_main();
+        void replay(const RenderLog& log);
+        void map_replayed_pages(const uint8_t* snapshot);
+#else
+        bool renders_on_thread() const { return false; }
+        bool replaying() const { return false; }
+#endif
 };
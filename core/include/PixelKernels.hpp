@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * The PPU's per-pixel loops, written to work on whole rows at a time so
+ * they can be vectorised. Every kernel has a portable version. On x86-64
+ * there are also SSE2 versions, which every x86-64 host has, and AVX2
+ * versions that are picked when the host supports them. The choice is made
+ * once, when the kernels are constructed. Building with VNES_NO_SIMD forces
+ * the portable versions, which is handy for checking the others against.
+ *
+ * Pixel values follow the PPU's palette RAM layout:
+ *  background: attribute << 2 | pattern, pattern 0 is transparent
+ *  sprite:     0x10 | attribute << 2 | pattern, 0 where there's no sprite,
+ *              plus SPRITE_BEHIND if the sprite is behind the background
+ */
+class PixelKernels{
+    public:
+        PixelKernels();
+
+        static constexpr uint8_t SPRITE_BEHIND = 0x20;
+
+        // Expands the 16 bytes of a tile (low planes, then high planes) to
+        // 64 pattern values of 0-3, row by row, and to the same rows mirrored
+        void (*decode_tile)(const uint8_t* planes, uint8_t* normal, uint8_t* flipped);
+
+        // out = the sprite pixel where there is an opaque one in front of
+        // (or over a transparent) background pixel, else the background
+        // pixel, or 0 where that's transparent. count is a multiple of 32.
+        void (*compose)(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count);
+
+        // out = colours[index] for each pixel, colours has 32 entries. count
+        // is a multiple of 8.
+        void (*map_colours)(const uint8_t* indices, const uint32_t* colours, uint32_t* out, int count);
+
+        const char* name; // which set was picked, for the log
+
+    private:
+        static void decode_tile_scalar(const uint8_t* planes, uint8_t* normal, uint8_t* flipped);
+        static void compose_scalar(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count);
+        static void map_colours_scalar(const uint8_t* indices, const uint32_t* colours, uint32_t* out, int count);
+
+#if defined(__x86_64__) && !defined(VNES_NO_SIMD)
+        static void decode_tile_sse2(const uint8_t* planes, uint8_t* normal, uint8_t* flipped);
+        static void compose_sse2(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count);
+        static void compose_avx2(const uint8_t* background, const uint8_t* sprites, uint8_t* out, int count);
+        static void map_colours_avx2(const uint8_t* indices, const uint32_t* colours, uint32_t* out, int count);
+#endif
+};
@@ -17,6 +17,17 @@ class RAM{
 
         void dump(); // dumps RAM contents (as visible through RAM::read() calls) to stdout
 
+        // for code caches: the 2KiB internal RAM (0x0000 - 0x07FF, unmirrored)
+        // and the cartridge's PRG-ROM generation
+        uint8_t* internal_ram(){ return ram; }
+        uint32_t prg_generation(){ return cart.prg_generation(); }
+
+        // Memory behind a 256 byte page of the address space, for the CPU's
+        // page table. nullptr if the page has registers in it (or is ROM,
+        // for writes) and has to go through read()/write().
+        uint8_t* read_page(uint8_t page);
+        uint8_t* write_page(uint8_t page);
+
         // The addresses of the the reserved 16 bit vectors, in little
         // endian format. The lower 8 bits are stored at ADDR and the higher at
         // ADDR+1
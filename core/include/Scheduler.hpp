@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+
+/*
+ * Keeps track of when each component next needs to do something that the
+ * rest of the system can see, so the CPU can run freely in between instead
+ * of stepping every component after every instruction.
+ *
+ * Times are timestamps on the master clock, counted from power up. The CPU
+ * and PPU both run off dividers of the master clock, so their cycles line
+ * up without rounding. Only the CPU moves time forwards: other components
+ * are caught up to the CPU's timestamp when the CPU touches their
+ * registers, when one of their events is due, or at the end of a frame.
+ */
+class Scheduler{
+    public:
+        Scheduler();
+
+        // NTSC: 21.477272 MHz master clock, the CPU divides it by 12 and the PPU by 4
+        static constexpr uint64_t CPU_CLOCK_DIVIDER = 12;
+        static constexpr uint64_t PPU_CLOCK_DIVIDER = 4;
+        static constexpr uint64_t NEVER = UINT64_MAX;
+
+        enum Event : uint8_t{
+            PPU_VBLANK,     // the PPU sets the vblank flag and raises NMI if it is enabled
+            PPU_STATUS,     // the PPU sets sprite 0 hit or clears its flags, see PPU::schedule_status()
+            APU_IRQ,        // the APU's frame counter or DMC raises its IRQ
+            EVENT_COUNT
+        };
+
+        void schedule(Event event, uint64_t timestamp);
+        void cancel(Event event);
+
+        bool     due(Event event, uint64_t timestamp) const { return event_time[event] <= timestamp; }
+        uint64_t time_of(Event event) const { return event_time[event]; }
+        uint64_t next_event_time() const { return next_time; } // earliest of all scheduled events
+
+        /* interrupt lines into the CPU */
+        /* NMI is edge triggered, so raising it latches it until the CPU
+         * takes it. IRQ is level triggered and stays asserted while any
+         * source holds it. Sources that assert them at a predictable time
+         * also schedule an event for it, so the CPU is between slices and
+         * polls the lines right when it happens.
+         */
+        enum IrqSource : uint8_t{
+            IRQ_APU_FRAME   = 0x01,
+            IRQ_DMC         = 0x02,
+            IRQ_MAPPER      = 0x04
+        };
+
+        void raise_nmi(){ nmi_latched = true; }
+        bool nmi_pending() const { return nmi_latched; }
+        bool take_nmi(){ bool latched = nmi_latched; nmi_latched = false; return latched; }
+
+        void assert_irq(IrqSource source){ irq_lines |= source; }
+        void release_irq(IrqSource source){ irq_lines &= ~source; }
+        bool irq_asserted() const { return irq_lines != 0; }
+
+        /* CPU stalls */
+        /* Cycles the CPU is halted for by DMA. Whoever halts the CPU adds
+         * to them, and the CPU takes them after the access that started the
+         * DMA, adding them to its own time.
+         */
+        void     stall_cpu(uint32_t cycles){ cpu_stall += cycles; }
+        uint32_t take_cpu_stall(){ uint32_t cycles = cpu_stall; cpu_stall = 0; return cycles; }
+
+    private:
+        std::array<uint64_t, EVENT_COUNT> event_time;
+        uint64_t next_time;
+
+        bool    nmi_latched;
+        uint8_t irq_lines; // IrqSource bits
+        uint32_t cpu_stall;
+
+        void update_next_time();
+};
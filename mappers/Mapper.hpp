@@ -1,10 +1,61 @@
 #pragma once
 
+#include <stdint.h>
 #include <string>
+#include "../common/log.hpp"
 
+/*
+ * Common state of every mapper. Mappers aren't called through virtual
+ * functions: Cartridge keeps the concrete mapper in a std::variant (see
+ * mapper_includes.hpp) and dispatches with std::visit, so each mapper's
+ * read(), write() and page lookups can be inlined into the caller. A mapper
+ * hides the functions below with its own versions.
+ *
+ * Used as is, this is the cartridge's state before a mapper is set.
+ */
 class Mapper{
     public:
-        std::string name;
-        virtual uint8_t read(uint16_t addr) = 0;
-        virtual void    write(uint16_t addr, uint8_t data) = 0; // some mappers may reject calls to this
+        std::string name = "None";
+
+        uint8_t read(uint16_t addr){
+            VNES_LOG::LOG(VNES_LOG::ERROR, "Cartridge read at address 0x%x before a mapper was set", addr);
+            return 0;
+        }
+        void    write(uint16_t addr, uint8_t data){ // some mappers may reject calls to this
+            VNES_LOG::LOG(VNES_LOG::ERROR, "Cartridge write at address 0x%x with data 0x%x before a mapper was set", addr, data);
+        }
+
+        // Memory the CPU can access directly for the 256 byte page at
+        // (page << 8), or nullptr if accesses have to go through read() and
+        // write(). Asked again for every page whenever prg_generation
+        // changes, so bank switches must bump it.
+        uint8_t* prg_page(uint8_t page, bool writable){ (void)page; (void)writable; return nullptr; }
+
+        // Memory behind the 1KiB page of the PPU's pattern tables at
+        // (page << 10), or nullptr if nothing is mapped there. Asked again
+        // for every page whenever chr_generation changes.
+        uint8_t* chr_page(uint8_t page){ (void)page; return nullptr; }
+
+        // Memory behind nametable 0-3 (0x2000, 0x2400, 0x2800, 0x2C00). The
+        // default mirrors the PPU's 2KiB of CIRAM as wired on the cartridge
+        // (see https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring),
+        // mappers with their own mirroring control or nametable RAM hide it.
+        // layout is a Cartridge::NametableLayout.
+        uint8_t* nametable_page(uint8_t table, uint8_t* ciram, int layout){
+            if(layout == 0){
+                // vertical arrangement: 0x2000 = 0x2400, 0x2800 = 0x2C00
+                return &ciram[(table >> 1) * 0x400];
+            }
+            // horizontal arrangement: 0x2000 = 0x2800, 0x2400 = 0x2C00
+            return &ciram[(table & 1) * 0x400];
+        }
+
+        // Bumped whenever the PRG-ROM seen by the CPU changes (a bank switch
+        // or a write into ROM), so anything caching decoded or translated
+        // code knows to throw it away
+        uint32_t prg_generation = 0;
+
+        // Bumped whenever the CHR banks or nametable mirroring change, so the
+        // PPU knows to remap its pages
+        uint32_t chr_generation = 0;
 };
@@ -25,7 +25,7 @@ class Mapper000 : public Mapper{
             VNES_LOG::LOG(VNES_LOG::DEBUG, "Done initializing Mapper000");
         }
 
-        uint8_t read(uint16_t addr) override {
+        uint8_t read(uint16_t addr) {
             using namespace VNES_LOG;
 
             switch(addr){
@@ -46,7 +46,7 @@ class Mapper000 : public Mapper{
             }
         }
 
-        void write(uint16_t addr, uint8_t data) override {
+        void write(uint16_t addr, uint8_t data) {
             using namespace VNES_LOG;
             switch(addr){
                 case 0x6000 ... 0x7FFF:
@@ -59,6 +59,7 @@ class Mapper000 : public Mapper{
                     }else{
                         prg_rom[addr % 0x8000] = data;
                     }
+                    prg_generation++;
                     break;
                 default:
                     LOG(ERROR, "Out of bound cartridge mapper write at address 0x%x (expected 0x6000 to 0xFFFF) with data 0x%x", addr, data);
@@ -66,12 +67,40 @@ class Mapper000 : public Mapper{
             }
         }
 
+        uint8_t* prg_page(uint8_t page, bool writable) {
+            uint16_t addr = page << 8;
+            size_t offset = 0;
+            switch(addr){
+                case 0x6000 ... 0x7FFF:
+                    return &prg_ram[addr % 0x6000];
+                case 0x8000 ... 0xFFFF:
+                    if(writable){
+                        return nullptr; // ROM writes are logged and bump prg_generation in write()
+                    }
+                    offset = mirror_prg_16kb ? (addr % 0x8000) % 0x4000 : addr % 0x8000;
+                    if(offset + 0x100 > prg_rom.size()){
+                        return nullptr;
+                    }
+                    return &prg_rom[offset];
+                default:
+                    return nullptr;
+            }
+        }
+
+        uint8_t* chr_page(uint8_t page){
+            if(chr_rom.size() < 0x2000){
+                return &chr_ram[(page % 8) * 0x400]; // no CHR-ROM, the board has 8KiB CHR-RAM instead
+            }
+            return &chr_rom[(page % 8) * 0x400];
+        }
+
     private:
         // provided by constructor
         std::vector<uint8_t>& prg_rom;
         std::vector<uint8_t>& chr_rom;
         uint8_t prg_ram[0x2000] {}; // Original hardware Mapper000 doesn't contain this memory, but some emulators included it,
                                     // so for compatibility 8KiB is included just in case
+        uint8_t chr_ram[0x2000] {};
 
         // if the program data loaded from the cart is less than 16kb, then 
         // address 0xc000-0xFFFF mirrors 0x8000-0xBFFF
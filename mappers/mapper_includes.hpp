@@ -1,3 +1,9 @@
 #pragma once
 
+#include <variant>
+#include "./Mapper.hpp"
 #include "./Mapper000.cpp"
+
+// Every mapper the cartridge can hold. New mappers go here as well as in
+// Cartridge::set_mapper(). Mapper itself is the empty state.
+typedef std::variant<Mapper, Mapper000> MapperVariant;
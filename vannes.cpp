@@ -7,16 +7,18 @@
 #include "common/nes_assert.hpp"
 #include "cartridge/cartridge.cpp"
 #include "core/DMABus.cpp"
+#include "core/Scheduler.cpp"
 #include "mappers/Mapper000.cpp"
 #include "controllers/Controller.cpp"
 
 #include <chrono>
 #include <ostream>
 #include <algorithm>
+#include <vector>
 
 #include <raylib.h>
 
-void parse_args(int argc, char** argv, std::string& rom_filename){
+void parse_args(int argc, char** argv, std::string& rom_filename, std::string& palette_filename, bool& indexed_output, int& frame_skip){
     for(int i = 1; i < argc; i++){
         std::string arg {argv[i]};
         int split_pos = arg.find("=");
@@ -26,6 +28,12 @@ void parse_args(int argc, char** argv, std::string& rom_filename){
 
         if(variable == "rom"){
             rom_filename = value;
+        }else if(variable == "palette"){
+            palette_filename = value;
+        }else if(variable == "indexed_output"){
+            indexed_output = (value == "1");
+        }else if(variable == "frame_skip"){
+            frame_skip = std::max(1, std::atoi(value.c_str())); // draw 1 frame in frame_skip
         }else if(variable == "log_level"){
             VNES_LOG::log_level = (VNES_LOG::Severity)std::atoi(value.c_str());
         }else if(variable == "log_to_file"){
@@ -52,18 +60,24 @@ int main(int argc, char** argv){
     const int WIN_DEFAULT_WIDTH = 1024;
     const int WIN_DEFAULT_HEIGHT = 896;
     const int TARGET_FPS = 60;
+    const int AUDIO_CHUNK = 1024; // samples handed to the audio device at a time
+    const size_t AUDIO_LOW_WATER = 2 * AUDIO_CHUNK; // frames are run while fewer samples than this are waiting
+    const size_t MAX_AUDIO_QUEUE = 4 * AUDIO_CHUNK;
+    const int MAX_FRAMES_PER_LOOP = 2;
 
     (void)NES_WIDTH;
     (void)NES_HEIGHT;
     (void)WIN_DEFAULT_WIDTH;
     (void)WIN_DEFAULT_HEIGHT;
-    (void)TARGET_FPS;
 
 
     //std::string rom_filename {"roms/Super Mario Bros. (Japan, USA).nes"};
     std::string rom_filename {"roms/nestest.nes"};
     //std::string rom_filename {""};
-    parse_args(argc, argv, rom_filename);
+    std::string palette_filename {""};
+    bool indexed_output = false;
+    int frame_skip = 1;
+    parse_args(argc, argv, rom_filename, palette_filename, indexed_output, frame_skip);
     init_log();
 
     Controller controller = Controller(KEYBOARD);
@@ -74,8 +88,15 @@ int main(int argc, char** argv){
     //ram.write(PPU::PPU_STATUS, 0xFF); // programs wait for PPU at reset
 
     DMABus dma_bus {ram};
-    PPU ppu = PPU(cart, dma_bus);
-    CPU cpu = CPU(ram, ppu);
+    Scheduler scheduler;
+    PPU ppu = PPU(cart, dma_bus, scheduler);
+    CPU cpu = CPU(ram, ppu, scheduler);
+    if(!palette_filename.empty()){
+        ppu.load_palette(palette_filename);
+    }
+    if(indexed_output){
+        ppu.output_mode = PPU::INDEXED_OUTPUT;
+    }
 
     log_level = INFO;
 
@@ -102,13 +123,13 @@ int main(int argc, char** argv){
     //    }
     //}
     
-    uint64_t frame_cycles_to_do = 30000;
-    int steps_done = 0;
+    uint64_t frames_done = 0;
+    uint64_t steps_done = 0;
 
     SetTraceLogLevel(LOG_ERROR);
     InitWindow(WIN_DEFAULT_WIDTH, WIN_DEFAULT_HEIGHT, "vannes");
     SetWindowState(FLAG_WINDOW_RESIZABLE);
-    SetTargetFPS(120);
+    SetTargetFPS(TARGET_FPS);
     Texture2D text = LoadTexture("default_texture.png");
     assert(text.width == NES_WIDTH);
     assert(text.height == NES_HEIGHT);
@@ -119,56 +140,74 @@ int main(int argc, char** argv){
         pixels[i] = 0xFFFFFFFF - i;
     }
 
-    unsigned int background_colour = col2uint((Color){30, 30, 30, 255});
+    InitAudioDevice();
+    SetAudioStreamBufferSizeDefault(AUDIO_CHUNK);
+    AudioStream audio = LoadAudioStream(APU::SAMPLE_RATE, 16, 1);
+    PlayAudioStream(audio);
+    std::vector<int16_t> audio_queue; // samples the audio device hasn't taken yet
+
     while(!WindowShouldClose()){
 
         // Update section
         controller.get_input();
-        while(cpu.frame_cycles < frame_cycles_to_do){
-            //fprintf(file, "%4x  A:%2x X:%2x Y:%2x P:%2x SP:%2x\n", cpu.program_counter, cpu.accumulator, cpu.index_X, cpu.index_Y, cpu.status_as_int(), cpu.stack_pointer);
-            cpu.step();
-            steps_done++;
-
-            //std::cin.get();
+        //fprintf(file, "%4x  A:%2x X:%2x Y:%2x P:%2x SP:%2x\n", cpu.program_counter, cpu.accumulator, cpu.index_X, cpu.index_Y, cpu.status_as_int(), cpu.stack_pointer);
+        // The audio device sets the pace: the NES makes slightly more than
+        // 60 frames a second and the window may not redraw at exactly 60,
+        // so frames are run while the device is running out of samples
+        // instead of once per redraw. Without audio, one per redraw.
+        const bool audio_paced = IsAudioDeviceReady();
+        for(int frames = 0; frames < MAX_FRAMES_PER_LOOP; frames++){
+            if(audio_paced ? audio_queue.size() >= AUDIO_LOW_WATER : frames > 0){
+                break;
+            }
+            ppu.render_skip = (frames_done % frame_skip) != 0;
+            steps_done += cpu.run_frame();
+            frames_done++;
+
+            size_t queued = audio_queue.size();
+            audio_queue.resize(queued + cpu.apu.samples_available());
+            cpu.apu.read_samples(audio_queue.data() + queued, audio_queue.size() - queued);
+        }
+        // without a device the samples go nowhere, and with one only a
+        // stall lets the queue grow this far, so drop the oldest to catch up
+        if(!audio_paced){
+            audio_queue.clear();
+        }else if(audio_queue.size() > MAX_AUDIO_QUEUE){
+            audio_queue.erase(audio_queue.begin(), audio_queue.end() - MAX_AUDIO_QUEUE);
+        }
+        while(IsAudioDeviceReady() && IsAudioStreamProcessed(audio)){
+            int16_t chunk[AUDIO_CHUNK] = {}; // silence if the queue runs dry
+            const size_t count = std::min(audio_queue.size(), (size_t)AUDIO_CHUNK);
+            std::copy(audio_queue.begin(), audio_queue.begin() + count, chunk);
+            audio_queue.erase(audio_queue.begin(), audio_queue.begin() + count);
+            UpdateAudioStream(audio, chunk, AUDIO_CHUNK);
         }
 
         char pressed_keys_text[10] = "XXXXXXXX";
         pressed_keys_text[9] = '\0';
         if(controller.START_PRESSED){
             pressed_keys_text[6] = 'S';
-            background_colour = col2uint(MAGENTA);
         }
         if(controller.SELECT_PRESSED){
             pressed_keys_text[7] = 's';
-            background_colour = col2uint(GREEN);
         }
         if(controller.A_PRESSED){
             pressed_keys_text[1] = 'A';
-            background_colour = col2uint(VIOLET);
         }
         if(controller.B_PRESSED){
             pressed_keys_text[0] = 'B';
-            background_colour = col2uint(ORANGE);
         }
         if(controller.UP_PRESSED){
             pressed_keys_text[2] = 'U';
-            background_colour = col2uint(RED);
         }
         if(controller.DOWN_PRESSED){
             pressed_keys_text[3] = 'D';
-            background_colour = col2uint(BLUE);
         }
         if(controller.LEFT_PRESSED){
             pressed_keys_text[4] = 'L';
-            background_colour = col2uint(GREEN);
         }
         if(controller.RIGHT_PRESSED){
             pressed_keys_text[5] = 'R';
-            background_colour = col2uint(PURPLE);
-        }
-
-        for(int i = 0; i < 256*224; i++){
-            ppu.buffer[i] = background_colour;
         }
 
         // Render section
@@ -177,8 +216,12 @@ int main(int argc, char** argv){
 
         float texture_scale = std::min((float)GetScreenWidth() / NES_WIDTH, (float)GetScreenHeight() / NES_HEIGHT);
         Vector2 texture_pos = {(GetScreenWidth() - NES_WIDTH*texture_scale) / 2, 0};
-        //UpdateTexture(text, pixels);
-        UpdateTexture(text, ppu.buffer);
+        if(ppu.output_mode == PPU::INDEXED_OUTPUT){
+            ppu.present(pixels);
+            UpdateTexture(text, pixels);
+        }else{
+            UpdateTexture(text, ppu.buffer);
+        }
 
         DrawTextureEx(text, texture_pos, 0, texture_scale, WHITE);
 
@@ -201,13 +244,15 @@ int main(int argc, char** argv){
         EndDrawing();
 
     }
+    UnloadAudioStream(audio);
+    CloseAudioDevice();
     CloseWindow();
 
     std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
     auto secs = std::chrono::duration_cast<std::chrono::seconds> (end - begin).count();
     auto milli = std::chrono::duration_cast<std::chrono::milliseconds> (end - begin).count();
     auto micro = std::chrono::duration_cast<std::chrono::microseconds> (end - begin).count();
-    std::cout << frame_cycles_to_do << " frame cycles and " << steps_done << " steps took " << secs << "s = " << milli << "ms = " << micro << "us" << std::endl;
+    std::cout << frames_done << " frames and " << steps_done << " steps took " << secs << "s = " << milli << "ms = " << micro << "us" << std::endl;
     //std::cout << frame_cycles_to_do << " frame cycles and " << steps_done << " steps took " << std::chrono::duration_cast<std::chrono::milliseconds> (end - begin).count() << "ms" << std::endl;
     //std::cout << frame_cycles_to_do << " frame cycles and " << steps_done << " steps took " << std::chrono::duration_cast<std::chrono::microseconds> (end - begin).count() << "µs" << std::endl;
     printf("(cpu did %ld cycles since reset)\n", cpu.cycles_since_reset);